@@ -24,21 +24,61 @@
  *        is not set. To completely invalidate the TLB, load it with
  *        translations for addresses in one of the unmapped address
  *        ranges - these will never be matched.
+ *
+ *        The PID field of ENTRYHI takes part in the match.
+ *
+ *   TLB_SetPID: set the address space ID that user translations are
+ *        matched against from now on. The other functions preserve it.
  */
 
 void TLB_Random(u_int32_t entryhi, u_int32_t entrylo);
 void TLB_Write(u_int32_t entryhi, u_int32_t entrylo, u_int32_t index);
 void TLB_Read(u_int32_t *entryhi, u_int32_t *entrylo, u_int32_t index);
 int TLB_Probe(u_int32_t entryhi, u_int32_t entrylo);
-void TLB_evict_entry(u_int32_t *entryhi, u_int32_t *entrylo);
+void TLB_SetPID(u_int32_t pid);
+
+/*
+ * Software TLB replacement, in tlb.c.
+ *
+ *   tlb_replace: load ENTRYHI/ENTRYLO into a slot chosen by the current
+ *        replacement policy. There must not already be an entry for the
+ *        same page and PID. PIN asks for the entry to be kept over
+ *        others where possible (the clock policy honours it for pages
+ *        of the current address space). Returns nonzero if a valid
+ *        entry may have been thrown out.
+ *
+ *   tlb_getpolicy/tlb_setpolicy: query or change the policy. The
+ *        default is TLB_POLICY_CLOCK if the kernel was configured with
+ *        "options tlbclock" and TLB_POLICY_RANDOM otherwise.
+ *
+ *   tlb_invalidate_page: drop the entry for ENTRYHI's page and PID, if
+ *        it is loaded.
+ *
+ *   tlb_invalidate_range: drop the entries for NPAGES pages starting at
+ *        ENTRYHI's page, all with ENTRYHI's PID. Other entries are left
+ *        alone.
+ *
+ *   tlb_flush_all: drop every entry, whatever its PID.
+ */
+
+#define TLB_POLICY_RANDOM 0	/* hardware tlbwr */
+#define TLB_POLICY_CLOCK  1	/* software second-chance clock */
+
+int tlb_replace(u_int32_t entryhi, u_int32_t entrylo, int pin);
+int tlb_getpolicy(void);
+void tlb_setpolicy(int policy);
+void tlb_invalidate_page(u_int32_t entryhi);
+void tlb_invalidate_range(u_int32_t entryhi, u_int32_t npages);
+void tlb_flush_all(void);
 
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID). An
+ * entry only matches while the PID in c0_entryhi equals its own, so
+ * translations for several address spaces can sit in the TLB at once.
+ * TLBLO_GLOBAL can be left always zero, as can the bits that aren't
+ * assigned a meaning.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -50,7 +90,8 @@ void TLB_evict_entry(u_int32_t *entryhi, u_int32_t *entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
@@ -73,5 +114,11 @@ void TLB_evict_entry(u_int32_t *entryhi, u_int32_t *entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of distinct address space IDs.
+ */
+
+#define NUM_TLB_PIDS 64
+
 
 #endif /* _MACHINE_TLB_H_ */
@@ -7,6 +7,7 @@
 #include <kern/callno.h>
 #include <kern/unistd.h>
 #include <kern/limits.h>
+#include <kern/memstat.h>
 #include <syscall.h>
 #include <curthread.h>
 #include <thread.h>
@@ -18,6 +19,7 @@
 #include <vnode.h>
 #include <vm.h>
 #include <clock.h>
+#include <scheduler.h>
 
 #define MAX_PATH_SIZE 128
 #define MAX_STRING 128 //assume same as path length
@@ -127,6 +129,37 @@ mips_syscall(struct trapframe *tf)
 			err = sbrk(tf->tf_a0, &retval);
 			break;
 
+	    case SYS_mmap:
+	    {
+		/* fd and offset are the 5th and 6th arguments, on the stack */
+		int32_t stackargs[2];
+
+		err = copyin((const_userptr_t)(tf->tf_sp + 16), stackargs,
+			     sizeof(stackargs));
+		if (err == 0) {
+			err = mmap((void *)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+				   tf->tf_a3, stackargs[0], stackargs[1],
+				   &retval);
+		}
+		break;
+	    }
+
+	    case SYS_munmap:
+		err = munmap((void *)tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_memstat:
+		err = memstat(tf->tf_a0, (struct memstat *)tf->tf_a1);
+		break;
+
+	    case SYS_settickets:
+		err = settickets(tf->tf_a0);
+		break;
+
+	    case SYS_setvmlimit:
+		err = setvmlimit(tf->tf_a0, tf->tf_a1);
+		break;
+
 	    default:
 			kprintf("Unknown syscall %d\n", callno);
 			err = ENOSYS;
@@ -215,17 +248,11 @@ fork(struct trapframe *tf, int *retval){
 
 	int spl = splhigh();
 
-	//copy the address space of the parent.
-	struct addrspace *as_child = kmalloc(sizeof(*as_child)); //AS_CREATE!!!!
-	if (as_child == NULL){
-		*retval = -1;
-		splx(spl);
-		return ENOMEM;
-	}
+	//copy the address space of the parent (copy-on-write, see as_copy).
+	struct addrspace *as_child = NULL;
 
 	int copy_vmspace = as_copy(curthread->t_vmspace, &as_child);
 	if(copy_vmspace != 0){
-		kfree(as_child);
 		*retval = -1;
 		splx(spl);
 		return ENOMEM;
@@ -265,7 +292,8 @@ fork(struct trapframe *tf, int *retval){
 
 	if(fork_result){
 		kfree(tf_copy);
-		kfree(as_child);
+		vfs_close((as_child->as_v).as_vnode);
+		as_destroy(as_child);
 		kprintf("Fork is failing");
 		*retval = -1;
 		splx(spl);
@@ -283,6 +311,8 @@ fork(struct trapframe *tf, int *retval){
 	}
 
 	newthread->t_proc->parent_pid = curthread->t_proc->pid;
+	newthread->t_proc->p_thread = newthread;
+	newthread->t_proc->p_tickets = curthread->t_proc->p_tickets;
 
 	//Return the child's PID from the parent's end
 
@@ -762,29 +792,166 @@ time_t sys_time(time_t *seconds, unsigned long *nanoseconds, unsigned int *retva
 
 int sbrk(int amount, int *retval) {
 
-	// amount = amount & PAGE_FRAME; //must be page aligned
-
 	struct addrspace* as = curthread->t_vmspace;
+	vaddr_t heapbase = as->memory_segments[HEAP].v_base;
+	vaddr_t oldbrk = as->as_brk;
+	vaddr_t newbrk;
+	u_int32_t delta;
+
+	//keep the break word aligned. Round in unsigned arithmetic, since
+	//amount + 3 overflows for amounts within 3 of INT_MAX; for negative
+	//amounts this gives the same two's complement result.
+	delta = ((u_int32_t)amount + 3) & ~3;
+	newbrk = oldbrk + delta;
+
+	if (amount < 0 && (newbrk > oldbrk || newbrk < heapbase)){
+		//trying to touch the data segment/go below the initial heap value
+		return EINVAL;
+	}
 
-	if (amount % 4 != 0){
-		ROUNDUP(amount, 4); //check if its word aligned
+	if (amount > 0 && (delta > as->as_heaplimit || newbrk < oldbrk ||
+			   newbrk >= as->heap_max ||
+			   newbrk - heapbase > as->as_heaplimit)){
+		//over the heap limit, or we'd be flowing into the stack
+		return ENOMEM;
 	}
 
-	if ((as->as_brk + amount) < (as->memory_segments[HEAP].v_base)){
-		//trying to touch the data segment/go below the initial heap value
+	//Shrinking gives back every page that now lies wholly above the
+	//break.
+
+	if (amount < 0) {
+		as_unmap(as, ROUNDUP(newbrk, PAGE_SIZE),
+			 ROUNDUP(oldbrk, PAGE_SIZE));
+	}
+
+	*retval = oldbrk;
+	as->as_brk = newbrk;
+	return 0;
+}
+
+//Change one of the caller's address space limits (VMLIMIT_* in
+//kern/unistd.h). Children inherit them; execv() starts over with the
+//defaults from vm.h.
+
+int
+setvmlimit(int which, size_t limit)
+{
+	struct addrspace *as = curthread->t_vmspace;
+
+	switch (which) {
+	    case VMLIMIT_STACK:
+		return as_setstacklimit(as, limit);
+	    case VMLIMIT_HEAP:
+		return as_setheaplimit(as, limit);
+	}
+	return EINVAL;
+}
+
+/****************************MMAP********************************/
+
+int
+mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset,
+     int *retval)
+{
+	unsigned int permissions = 0;
+	vaddr_t base;
+	int result;
+
+	//The address is only a hint, and we don't take hints.
+	(void)addr;
+	(void)offset;
+
+	if ((flags & (MAP_SHARED | MAP_PRIVATE)) != MAP_PRIVATE) {
+		//Shared mappings would need changes written back to the
+		//file (or kept shared across fork); only private ones exist.
 		return EINVAL;
 	}
 
-	if (as->as_brk + amount >= as->heap_max){
-		//not enough heap memory! We're flowing into the stack
-		return ENOMEM;
+	if (!(flags & MAP_ANON)) {
+		//There is no per-process file table to look fd up in, so
+		//only the kernel (as_mmap) can map files for now.
+		(void)fd;
+		return EBADF;
+	}
+
+	if (prot & PROT_READ) {
+		permissions |= PF_R;
 	}
+	if (prot & PROT_WRITE) {
+		permissions |= PF_W;
+	}
+	if (prot & PROT_EXEC) {
+		permissions |= PF_X;
+	}
+
+	result = as_mmap(curthread->t_vmspace, len, permissions, NULL, 0,
+			 &base);
+	if (result) {
+		return result;
+	}
+
+	*retval = (int)base;
+	return 0;
+}
+
+int
+munmap(void *addr, size_t len)
+{
+	return as_munmap(curthread->t_vmspace, (vaddr_t)addr, len);
+}
+
+/***************************MEMSTAT*******************************/
+
+//Report the memory footprint of process pid, or of the caller if pid is 0.
+//Any process may be looked at. One that has exited but not been waited for
+//owns no memory any more and reports all zeros.
+
+int
+memstat(pid_t pid, struct memstat *buf)
+{
+	struct memstat ms;
+	struct thread *t;
+	int spl;
+
+	bzero(&ms, sizeof(ms));
 
-	//use the actual segment info for debugging purposes. In reality this code is not
-	//to pleasing, as we're still probably giving enough info for an attacker
-	//to exploit the heap info. But this ain't the security lab, so...
+	spl = splhigh();
+
+	if (pid == 0) {
+		t = curthread;
+	}
+	else if (pid < 1 || pid > MAX_PID || process_table[pid - 1] == NULL) {
+		splx(spl);
+		return EINVAL;
+	}
+	else {
+		t = process_table[pid - 1]->p_thread;
+	}
+
+	if (t != NULL && t->t_vmspace != NULL) {
+		ms.ms_resident = t->t_vmspace->as_resident;
+		ms.ms_shared = t->t_vmspace->as_shared;
+		ms.ms_swapped = t->t_vmspace->as_swapped;
+	}
+
+	splx(spl);
+
+	return copyout(&ms, (userptr_t)buf, sizeof(ms));
+}
+
+/***************************SETTICKETS*******************************/
+
+//Set the caller's share of the CPU under the stride scheduler. Children
+//forked afterwards start with the same number. Without "options stride"
+//the tickets are kept but have no effect.
+
+int
+settickets(int tickets)
+{
+	if (tickets < 1 || tickets > STRIDE_MAX_TICKETS) {
+		return EINVAL;
+	}
 
-	*retval = (as->as_brk);
-	as->as_brk += amount;
+	curthread->t_proc->p_tickets = tickets;
 	return 0;
 }
@@ -1,12 +1,230 @@
-#include <tlb.h>
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <machine/tlb.h>
+#include <machine/vm.h>
+#include "opt-tlbclock.h"
 
-//function to evict (and replace) an entry in the TLB. This
-//ensures that the kernel does not crash once the TLB is filled
-//with entries. Right now the cache replacement algorithm is
-//very basic - pick a random index and remove the entry in it,
-//then write to that index. Eventually will want to replace it
-//with an LRU algorithm.
+/*
+ * TLB replacement.
+ *
+ * The hardware only offers tlbwr, which picks a slot pseudo-randomly
+ * and is as likely to throw out the page a loop is executing from as
+ * one that was touched once. The clock policy instead keeps a software
+ * reference bit per slot, set whenever an entry is loaded (the MIPS has
+ * no hardware reference bit, so "recently faulted" stands in for
+ * "recently used"), and sweeps a hand over the slots giving referenced
+ * entries a second chance. Entries loaded with PIN set (text and stack
+ * pages) are passed over too, as long as they belong to the address
+ * space being loaded and at most TLB_MAX_PINNED of them are pinned.
+ *
+ * The default comes from the tlbclock kernel option; tlb_setpolicy()
+ * switches at runtime so the two can be compared.
+ *
+ * Unmapping goes through tlb_invalidate_page/tlb_invalidate_range,
+ * which drop just the affected entries (and their clock bits) so the
+ * rest of the TLB survives. tlb_flush_all empties it, for when the
+ * ASIDs run out.
+ */
 
-void TLB_evict_entry(u_int32_t entryhi, u_int32_t entrylo){
-	TLB_Random(entryhi, entrylo);
+/* Never pin more than this many slots, so unpinned pages still fit. */
+#define TLB_MAX_PINNED (NUM_TLB / 2)
+
+#if OPT_TLBCLOCK
+static int tlb_policy = TLB_POLICY_CLOCK;
+#else
+static int tlb_policy = TLB_POLICY_RANDOM;
+#endif
+
+static u_int8_t tlb_refbit[NUM_TLB];
+static u_int8_t tlb_pinbit[NUM_TLB];
+static unsigned tlb_npinned;
+static unsigned tlb_hand;
+
+/*
+ * Pick a slot with the clock. Invalid slots are taken straight away.
+ * Pinned entries of the current address space are skipped for two full
+ * sweeps; by the third every reference bit has been cleared, so the
+ * loop always ends.
+ */
+static
+int
+tlb_clock_victim(u_int32_t pid, int *evicted)
+{
+	u_int32_t ehi, elo;
+	unsigned scanned, i;
+
+	for (scanned = 0; scanned < 3 * NUM_TLB; scanned++) {
+		i = tlb_hand;
+		tlb_hand = (tlb_hand + 1) % NUM_TLB;
+
+		TLB_Read(&ehi, &elo, i);
+
+		if ((elo & TLBLO_VALID) == 0) {
+			*evicted = 0;
+			return i;
+		}
+
+		if (tlb_pinbit[i] && (ehi & TLBHI_PID) == pid &&
+		    scanned < 2 * NUM_TLB) {
+			continue;
+		}
+
+		if (tlb_refbit[i]) {
+			tlb_refbit[i] = 0;
+			continue;
+		}
+
+		*evicted = 1;
+		return i;
+	}
+
+	panic("tlb: clock found no victim\n");
+	return -1;
+}
+
+int
+tlb_replace(u_int32_t entryhi, u_int32_t entrylo, int pin)
+{
+	int spl, evicted, i;
+
+	spl = splhigh();
+
+	if (tlb_policy == TLB_POLICY_RANDOM) {
+		/* Fill empty slots first; tlbwr only once the TLB is full. */
+		for (i = 0; i < NUM_TLB; i++) {
+			u_int32_t ehi, elo;
+
+			TLB_Read(&ehi, &elo, i);
+			if ((elo & TLBLO_VALID) == 0) {
+				TLB_Write(entryhi, entrylo, i);
+				splx(spl);
+				return 0;
+			}
+		}
+		TLB_Random(entryhi, entrylo);
+		splx(spl);
+		return 1;
+	}
+
+	i = tlb_clock_victim(entryhi & TLBHI_PID, &evicted);
+
+	if (tlb_pinbit[i]) {
+		tlb_pinbit[i] = 0;
+		tlb_npinned--;
+	}
+
+	TLB_Write(entryhi, entrylo, i);
+
+	tlb_refbit[i] = 1;
+	if (pin && tlb_npinned < TLB_MAX_PINNED) {
+		tlb_pinbit[i] = 1;
+		tlb_npinned++;
+	}
+
+	splx(spl);
+	return evicted;
+}
+
+/*
+ * Empty slot I, keeping the clock's bookkeeping in step.
+ */
+static
+void
+tlb_invalidate_slot(int i)
+{
+	TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+
+	tlb_refbit[i] = 0;
+	if (tlb_pinbit[i]) {
+		tlb_pinbit[i] = 0;
+		tlb_npinned--;
+	}
+}
+
+void
+tlb_invalidate_page(u_int32_t entryhi)
+{
+	int spl, i;
+
+	spl = splhigh();
+
+	i = TLB_Probe(entryhi, 0);
+	if (i >= 0) {
+		tlb_invalidate_slot(i);
+	}
+
+	splx(spl);
+}
+
+/*
+ * A short range is cheapest to probe page by page. Once it covers at
+ * least as many pages as there are slots, one pass over the slots
+ * reading each entry back is cheaper, and its cost no longer depends
+ * on the size of the range.
+ */
+void
+tlb_invalidate_range(u_int32_t entryhi, u_int32_t npages)
+{
+	u_int32_t pid, start, ehi, elo, k;
+	int spl, i;
+
+	pid = entryhi & TLBHI_PID;
+	start = entryhi & TLBHI_VPAGE;
+
+	spl = splhigh();
+
+	if (npages < NUM_TLB) {
+		for (k = 0; k < npages; k++) {
+			i = TLB_Probe((start + k * PAGE_SIZE) | pid, 0);
+			if (i >= 0) {
+				tlb_invalidate_slot(i);
+			}
+		}
+	}
+	else {
+		for (i = 0; i < NUM_TLB; i++) {
+			TLB_Read(&ehi, &elo, i);
+			if ((elo & TLBLO_VALID) && (ehi & TLBHI_PID) == pid &&
+			    (ehi & TLBHI_VPAGE) >= start &&
+			    ((ehi & TLBHI_VPAGE) - start) / PAGE_SIZE < npages) {
+				tlb_invalidate_slot(i);
+			}
+		}
+	}
+
+	splx(spl);
+}
+
+void
+tlb_flush_all(void)
+{
+	int spl, i;
+
+	spl = splhigh();
+	for (i = 0; i < NUM_TLB; i++) {
+		tlb_invalidate_slot(i);
+	}
+	splx(spl);
+}
+
+int
+tlb_getpolicy(void)
+{
+	return tlb_policy;
+}
+
+void
+tlb_setpolicy(int policy)
+{
+	int spl;
+
+	assert(policy == TLB_POLICY_RANDOM || policy == TLB_POLICY_CLOCK);
+
+	spl = splhigh();
+	tlb_policy = policy;
+	bzero(tlb_refbit, sizeof(tlb_refbit));
+	bzero(tlb_pinbit, sizeof(tlb_pinbit));
+	tlb_npinned = 0;
+	splx(spl);
 }
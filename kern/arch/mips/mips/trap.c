@@ -115,7 +115,8 @@ mips_trap(struct trapframe *tf)
 
 	/*
 	 * Ok, it wasn't any of the really easy cases.
-	 * Call vm_fault on the TLB exceptions.
+	 * Call vm_fault on the TLB exceptions, after giving the fast
+	 * refill path a try on plain misses.
 	 * Panic on the bus error exceptions.
 	 */
 	switch (code) {
@@ -125,12 +126,14 @@ mips_trap(struct trapframe *tf)
 		}
 		break;
 	case EX_TLBL:
-		if (vm_fault(VM_FAULT_READ, tf->tf_vaddr)==0) {
+		if (vm_tlbrefill(VM_FAULT_READ, tf->tf_vaddr)==0 ||
+		    vm_fault(VM_FAULT_READ, tf->tf_vaddr)==0) {
 			goto done;
 		}
 		break;
 	case EX_TLBS:
-		if (vm_fault(VM_FAULT_WRITE, tf->tf_vaddr)==0) {
+		if (vm_tlbrefill(VM_FAULT_WRITE, tf->tf_vaddr)==0 ||
+		    vm_fault(VM_FAULT_WRITE, tf->tf_vaddr)==0) {
 			goto done;
 		}
 		break;
@@ -1047,14 +1047,15 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Regular files can always be mapped; the VM system
+ * reads the pages in with VOP_READ as they are touched.
  */
 static
 int
 sfs_mmap(struct vnode *v   /* add stuff as needed */)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 /*
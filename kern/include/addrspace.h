@@ -14,6 +14,11 @@ struct vnode;
 #define HEAP 3
 #define STACK 2
 
+//Region codes for faults in mmap()ed memory. These are not indices into
+//memory_segments; the regions themselves are on the as_regions list.
+#define MMAP_ANON 4
+#define MMAP_FILE 5
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
@@ -28,6 +33,21 @@ struct as_vnode_data{
 };
 typedef struct as_vnode_info as_vnode_info;
 
+/*
+ * A region created by mmap(). Anonymous regions (vr_vnode NULL) are
+ * zero-filled like the heap; file regions are paged in from vr_vnode,
+ * page N of the region coming from file offset vr_offset + N*PAGE_SIZE.
+ * Both are private mappings.
+ */
+struct vm_region {
+	vaddr_t vr_base;
+	size_t vr_npages;
+	unsigned int vr_permissions;
+	struct vnode *vr_vnode;
+	off_t vr_offset;
+	struct vm_region *vr_next;
+};
+
 struct addrspace {
 #if OPT_DUMBVM
 	vaddr_t as_vbase1;
@@ -50,10 +70,32 @@ struct addrspace {
 
 	struct segment memory_segments[NUM_SEGMENTS];
 	vaddr_t as_brk; //current sbrk() value
-	vaddr_t as_stackptr;
-	vaddr_t heap_max;
+	vaddr_t as_stackptr; //lowest page of the stack so far
+	size_t as_stacklimit; //most the stack may grow to, in bytes
+	size_t as_heaplimit; //most the heap may grow to, in bytes
+	vaddr_t heap_max; //the break must stay below this (the guard pages under the stack or mmap()s)
+
+	struct vm_region *as_regions; //mmap()ed regions, unordered
 
 	struct as_vnode_data as_v;
+
+	//Read-ahead state per file-backed segment: where the next sequential
+	//fault is expected and how many pages the last one loaded.
+	vaddr_t as_ra_next[NUM_STATIC_SEGMENTS];
+	u_int32_t as_ra_window[NUM_STATIC_SEGMENTS];
+
+	//Page counts for the ps menu command and memstat(), kept by pte_set().
+	//Shared pages are resident pages mapped copy-on-write: frames shared
+	//since a fork, text from the page cache and the zero frame. A page whose
+	//other sharers have gone counts as shared until it is next written.
+	u_int32_t as_resident; //pages mapped to a frame
+	u_int32_t as_swapped; //pages out in swap
+	u_int32_t as_shared; //resident pages mapped copy-on-write
+
+	//TLB address space ID, valid only while as_asid_generation matches the
+	//current ASID generation (see as_activate).
+	u_int32_t as_asid;
+	u_int32_t as_asid_generation;
 #endif
 };
 
@@ -89,6 +131,19 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_unmap  - release every page in a page-aligned range, freeing
+ *                the frames and swap space behind it.
+ *
+ *    as_mmap   - add a region of LEN bytes, anonymous if V is NULL or
+ *                else backed by V from OFFSET, at an address of the
+ *                VM system's choosing.
+ *
+ *    as_munmap - remove a page-aligned range from the mmap()ed regions.
+ *
+ *    as_setstacklimit - change how many bytes the stack may grow to.
+ *
+ *    as_setheaplimit - change how many bytes the heap may grow to.
  */
 
 struct addrspace *as_create(void);
@@ -104,6 +159,13 @@ int               as_define_region(struct addrspace *as,
 int		  as_prepare_load(struct addrspace *as);
 int		  as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+void              as_unmap(struct addrspace *as, vaddr_t start, vaddr_t end);
+int               as_mmap(struct addrspace *as, size_t len,
+			  unsigned int permissions, struct vnode *v,
+			  off_t offset, vaddr_t *addr);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_setstacklimit(struct addrspace *as, size_t limit);
+int               as_setheaplimit(struct addrspace *as, size_t limit);
 
 /*
  * Functions in loadelf.c
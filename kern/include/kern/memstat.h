@@ -0,0 +1,15 @@
+#ifndef _KERN_MEMSTAT_H_
+#define _KERN_MEMSTAT_H_
+
+/*
+ * Structure for memstat (call to get a process's memory footprint).
+ * All counts are in pages.
+ */
+
+struct memstat {
+	u_int32_t ms_resident;	/* pages in memory */
+	u_int32_t ms_shared;	/* ...of which shared copy-on-write */
+	u_int32_t ms_swapped;	/* pages out in swap */
+};
+
+#endif /* _KERN_MEMSTAT_H_ */
@@ -35,6 +35,22 @@
 #define SEEK_CUR      1      /* Seek relative to current position in file */
 #define SEEK_END      2      /* Seek relative to end of file */
 
+/* Protections for mmap: any combination of these */
+#define PROT_NONE     0      /* Page may not be touched (not enforced) */
+#define PROT_READ     1      /* Page may be read */
+#define PROT_WRITE    2      /* Page may be written */
+#define PROT_EXEC     4      /* Page may be executed */
+
+/* Flags for mmap: choose one of these: */
+#define MAP_SHARED    1      /* Share changes (not supported) */
+#define MAP_PRIVATE   2      /* Changes are private */
+/* then or in: */
+#define MAP_ANON      4      /* Zero-filled memory; fd and offset ignored */
+
+/* Limits for setvmlimit */
+#define VMLIMIT_STACK 1      /* Most bytes the stack may grow to */
+#define VMLIMIT_HEAP  2      /* Most bytes the heap may grow to */
+
 /* The codes for ioctl are in kern/ioctl.h */
 /* The codes for stat/fstat/lstat are in kern/stat.h */
 
@@ -0,0 +1,52 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache for program text. Text pages are identified by the
+ * executable's vnode and the file offset they were loaded from, so every
+ * process running the same binary can map the same read-only frame
+ * instead of reading its own copy.
+ *
+ * The cache holds one reference on each frame (counted in the coremap
+ * refcount like any other mapping) and one vnode reference per entry.
+ * Mappings of cached frames are copy-on-write, so a stray write gets a
+ * private copy and the cached page stays intact.
+ *
+ * Functions in pagecache.c:
+ *
+ *    pcache_lookup  - return the frame caching OFFSET of V with a new
+ *                     reference taken for the caller's mapping, or 0 if
+ *                     the page isn't cached.
+ *
+ *    pcache_insert  - add the loaded frame at PADDR as the page at
+ *                     OFFSET of V. Returns EEXIST if that page is
+ *                     already cached, ENOMEM if no entry could be
+ *                     allocated; the caller then keeps the frame
+ *                     private.
+ *
+ *    pcache_reclaim - free cached pages that no address space maps any
+ *                     more, until TARGET frames are free or there are
+ *                     none left. Returns the number of frames freed.
+ *                     Never sleeps: the entries' vnode references are
+ *                     kept for pcache_release(), so this is safe from
+ *                     inside an allocation.
+ *
+ *    pcache_release - drop the vnode references of entries freed by
+ *                     pcache_reclaim. May sleep; call only from thread
+ *                     context (the pageout daemon does).
+ *
+ *    pcache_release_pending - nonzero if pcache_release has work.
+ */
+
+struct vnode;
+
+/* Number of hash chains. */
+#define PCACHE_BUCKETS 64
+
+paddr_t pcache_lookup(struct vnode *v, off_t offset);
+int pcache_insert(struct vnode *v, off_t offset, paddr_t paddr);
+u_int32_t pcache_reclaim(u_int32_t target);
+void pcache_release(void);
+int pcache_release_pending(void);
+
+#endif /* _PAGECACHE_H_ */
@@ -14,6 +14,8 @@ struct proc_info {
 	int exit_code;
 	// int exited;
 	pid_t parent_pid;
+	struct thread *p_thread; //the process's thread, NULL once it has exited
+	int p_tickets; //CPU share under the stride scheduler, see scheduler.h
 };
 
 typedef struct proc_info proc_info;
@@ -32,7 +34,7 @@ pid_t assign_pid();
 // Initializes the very first process created, called in cmd_progthread.
 struct proc_info * process_bootstrap();
 
-// Creates a new 'process'.
+// Creates a new 'process'. Returns NULL if out of memory or out of pids.
 struct proc_info *proc_create();
 
 // Destroys the given 'process'.
@@ -9,6 +9,12 @@
  *                     already on the run queue or sleeping, weird things
  *                     may happen. Returns an error code.
  *
+ *     scheduler_tick - charge a clock tick to the current thread. Returns
+ *                      nonzero if it should be preempted now. Called
+ *                      HZ times a second with interrupts off.
+ *     scheduler_sleep - note that thread T is about to go to sleep.
+ *                      Interrupts must be off.
+ *
  *     print_run_queue - dump the run queue to the console for debugging.
  *
  *     scheduler_bootstrap - initialize scheduler data 
@@ -20,9 +26,41 @@
 
 struct thread;
 
+/*
+ * A thread runs for a quantum of SCHED_QUANTUM clock ticks before it
+ * can be preempted, and then only if something else is runnable.
+ *
+ * With the mlfq option there are MLFQ_LEVELS run queues, 0 the highest
+ * priority, and the quantum doubles at each level down: interactive
+ * threads get short slices and CPU-bound ones long ones, so they switch
+ * less often. A thread that uses up its quantum drops a level; one that
+ * goes to sleep rises a level; every MLFQ_BOOST_TICKS ticks every
+ * runnable thread goes back to level 0, so nothing starves. A thread
+ * made runnable at a higher level than the running one preempts it at
+ * the next tick without waiting for the quantum to run out.
+ */
+#define SCHED_QUANTUM     2
+#define MLFQ_LEVELS       4
+#define MLFQ_BOOST_TICKS  HZ
+
+/*
+ * With the stride option each process holds between 1 and
+ * STRIDE_MAX_TICKETS tickets (p_tickets, set with settickets() and
+ * inherited across fork) and gets CPU time in proportion to them.
+ * Kernel threads without a process hold STRIDE_DEFAULT_TICKETS, as do
+ * new processes. A thread's pass advances by STRIDE1 / tickets per
+ * clock tick it runs.
+ */
+#define STRIDE_DEFAULT_TICKETS  100
+#define STRIDE_MAX_TICKETS      1000
+#define STRIDE1                 (1 << 20)
+
 struct thread *scheduler(void);
 int make_runnable(struct thread *t);
 
+int scheduler_tick(void);
+void scheduler_sleep(struct thread *t);
+
 void print_run_queue(void);
 
 void scheduler_bootstrap(void);
@@ -0,0 +1,39 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space. User pages are paged out to a raw disk device, one page
+ * per slot; slot N lives at byte offset N * PAGE_SIZE on the device.
+ *
+ * Functions in swap.c:
+ *
+ *    swap_bootstrap - open the swap device and size the slot bitmap.
+ *                     If there is no such device, paging stays off:
+ *                     when frames run out only the zero pool and the
+ *                     page cache are reclaimed, and after that the
+ *                     allocation fails (kmalloc returns NULL, a page
+ *                     fault gets ENOMEM).
+ *
+ *    swap_enabled   - nonzero once a swap device is attached.
+ *
+ *    swap_alloc     - reserve a free slot. Returns ENOSPC if swap is
+ *                     full.
+ *
+ *    swap_free      - give a slot back.
+ *
+ *    swap_out       - write the frame at PADDR to SLOT. May sleep.
+ *
+ *    swap_in        - read SLOT into the frame at PADDR. May sleep.
+ */
+
+/* Raw device path as registered by vfs_adddev(). */
+#define SWAP_DEVICE "lhd1raw:"
+
+void swap_bootstrap(void);
+int swap_enabled(void);
+int swap_alloc(u_int32_t *slot);
+void swap_free(u_int32_t slot);
+int swap_out(paddr_t paddr, u_int32_t slot);
+int swap_in(paddr_t paddr, u_int32_t slot);
+
+#endif /* _SWAP_H_ */
@@ -70,7 +70,8 @@ void         lock_destroy(struct lock *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
- *    cv_signal    - Wake up one thread that's sleeping on this CV.
+ *    cv_signal    - Wake up one thread that's sleeping on this CV (the
+ *                   one that has been waiting longest).
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
  * For all three operations, the current thread must hold the lock passed 
@@ -88,7 +89,6 @@ void         lock_destroy(struct lock *);
 
 struct cv {
 	char *name;
-	volatile struct lock *cv_lock;
 };
 
 struct cv *cv_create(const char *name);
@@ -48,6 +48,23 @@ time_t sys_time(time_t *seconds, unsigned long *nanoseconds, unsigned int *retva
 /********MALLOC********/
 
 int sbrk(int amount, int * retval);
+int setvmlimit(int which, size_t limit);
+
+/********MMAP********/
+
+int mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset,
+	 int *retval);
+int munmap(void *addr, size_t len);
+
+/********MEMSTAT********/
+
+struct memstat;
+
+int memstat(pid_t pid, struct memstat *buf);
+
+/********SETTICKETS********/
+
+int settickets(int tickets);
 
 
 #endif /* _SYSCALL_H_ */
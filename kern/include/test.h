@@ -24,9 +24,13 @@ int queuetest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int wchanbench(int, char **);
+int schedbench(int, char **);
+int stridetest(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int pctest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
@@ -36,6 +40,13 @@ int writestress2(int, char **);
 int createstress(int, char **);
 int printfile(int, char **);
 
+/* vm tests */
+int exitbench(int, char **);
+int faultbench(int, char **);
+int tlbbench(int, char **);
+int mmaptest(int, char **);
+int lpagebench(int, char **);
+
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
@@ -19,8 +19,13 @@ struct thread {
 	struct pcb t_pcb;
 	char *t_name;
 	const void *t_sleepaddr;
+	struct thread *t_wchan_next;	/* next sleeper on t_sleepaddr */
 	char *t_stack;
 	struct proc_info *t_proc;
+	int t_priority;			/* run queue level; 0 is highest */
+	int t_quantum;			/* clock ticks left in time slice */
+	u_int32_t t_pass;		/* stride scheduling virtual time */
+	int t_pass_relative;		/* t_pass is an offset, not queued */
 	
 	/**********************************************************/
 	/* Public thread members - can be used by other code      */
@@ -15,7 +15,18 @@
 /*RANDOM DEFINITIONS*/
 
 #define DUMBVM_STACKPAGES 12
-#define JAFFVM_STACKPAGES 500
+
+//The user stack grows on demand up to as_stacklimit bytes, and never to within
+//STACK_GUARD_PAGES of the heap. New programs start with USERSTACK_LIMIT; a
+//process can change its own with setvmlimit(), and fork() passes it on.
+#define USERSTACK_LIMIT (8 * 1024 * 1024)
+#define STACK_GUARD_PAGES 1
+
+//Likewise the heap may grow to as_heaplimit bytes, or until it reaches the
+//stack's guard pages, and starts out at USERHEAP_LIMIT (also changed with
+//setvmlimit()). The default leaves the guard pages as the only real limit, so
+//a program can use as much memory as the machine has.
+#define USERHEAP_LIMIT (1024 * 1024 * 1024)
 #define MIPS_KSEG0  0x80000000
 #define KVADDR_TO_PADDR(vaddr) (vaddr - MIPS_KSEG0)
 
@@ -27,10 +38,37 @@
    int chunk_size;
    struct addrspace * as;
 
+   //Number of PTEs mapping this frame. Frames shared copy-on-write after a
+   //fork have a count above 1 and are only freed when it drops to 0.
+   int refcount;
+
+   //Reverse mapping for page replacement: the user virtual page this frame
+   //backs in as. The referenced and dirty bits live in that page's PTE.
+   vaddr_t vaddr;
+
+   //Pin count. A pinned frame is being filled, copied or written out and is
+   //never picked for eviction.
+   int pinned;
+
+   //Swap slot holding a copy of this page, or -1. The copy is up to date
+   //unless the PTE is dirty; clean pages can be freed without any I/O.
+   int swap_slot;
+
+   /*Buddy allocator bookkeeping. Only meaningful for the first entry of a
+     free block: order is log2 of the block length, and next/prev link the
+     block into the free list for that order (-1 terminates).*/
+   int is_free_head;
+   int order;
+   int buddy_next;
+   int buddy_prev;
  };
 
 typedef struct coremap_entry coremap_entry;
 
+//Largest block the buddy allocator tracks is 2^BUDDY_MAX_ORDER frames (4MB).
+#define BUDDY_MAX_ORDER 10
+#define BUDDY_NUM_ORDERS (BUDDY_MAX_ORDER + 1)
+
 extern struct coremap_entry * coremap;
 
 // Number of pages taken up by coremap
@@ -41,6 +79,9 @@ extern u_int32_t num_free_coremap_entries;
 //Flag to signal that thread_bootstrap is complete.
 extern int booted;
 
+//Convert a physical address to its coremap index.
+#define PADDR_TO_COREMAP_INDEX(paddr) (((paddr) - coremap_base_page_offset) / PAGE_SIZE)
+
 /* Initialization function */
 void coremap_bootstrap();
 
@@ -48,6 +89,21 @@ void coremap_bootstrap();
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+/*****************PAGEOUT DAEMON*************************/
+
+//The pageout daemon starts work when fewer than 1/PAGEOUT_LOW_DIVISOR of all
+//frames are free and stops once 1/PAGEOUT_HIGH_DIVISOR are. Dirty pages are
+//written out up to PAGEOUT_BATCH per sweep.
+#define PAGEOUT_LOW_DIVISOR 32
+#define PAGEOUT_HIGH_DIVISOR 16
+#define PAGEOUT_BATCH 16
+
+extern u_int32_t pageout_low;
+extern u_int32_t pageout_high;
+
+/* Thread body, forked from boot() */
+void pageout_thread(void *, unsigned long);
+
 /*****************PAGE TABLE*************************/
 
 #define NUMBER_OF_PAGE_TABLE_ENTRIES 1024
@@ -55,23 +111,67 @@ void free_kpages(vaddr_t addr);
 //2 level table which acts as a set-associative
 //cache that
 
-//Level 2 of the Page Table - an array of size total_coremap_entries
+//A single page table entry/PTE is one 32-bit word. The top 20 bits hold the
+//physical frame number (so masking gives the frame's paddr), or the swap slot
+//if PTE_SWAPPED is set. The low bits are flags.
 
-struct page_table_entry_array {
-struct page_table_entry *second_level_page_table[NUMBER_OF_PAGE_TABLE_ENTRIES];
-};
+typedef u_int32_t page_table_entry;
 
-//structure for a single page table entry/PTE
+#define PTE_FRAME       0xfffff000 //frame number (or swap slot) << 12
+#define PTE_VALID       0x00000001 //entry is in use
+#define PTE_DIRTY       0x00000002 //written since its swap copy was made
+#define PTE_REFERENCED  0x00000004 //loaded into the TLB since the clock passed
+#define PTE_SWAPPED     0x00000008 //page is out on disk
+#define PTE_COW         0x00000010 //frame is shared with another address space; copy on write
+#define PTE_PERM_MASK   0x000000e0 //READ: 001, WRITE: 010, XEC: 100
+#define PTE_PERM_SHIFT  5
+#define PTE_RUN         0x00000100 //mapped as part of a large page; TLB refills load the whole run
 
-struct page_table_entry {
- // vaddr_t vaddr;
- paddr_t pfn:20;
- unsigned int permissions:3; //READ: 001, WRITE: 010, XEC: 100
+#define PTE_PADDR(pte) ((paddr_t)((pte) & PTE_FRAME))
+#define PTE_SLOT(pte) ((u_int32_t)(pte) >> 12)
+#define PTE_PERMISSIONS(pte) (((pte) & PTE_PERM_MASK) >> PTE_PERM_SHIFT)
+
+//Level 2 of the Page Table - exactly one page of inline PTEs, allocated
+//straight from the coremap rather than kmalloc.
+
+struct page_table_entry_array {
+page_table_entry second_level_page_table[NUMBER_OF_PAGE_TABLE_ENTRIES];
 };
 
-typedef struct page_table_entry page_table_entry;
 typedef struct page_table_entry_array page_table_entry_array;
 
+/*****************ZEROED FRAMES*************************/
+
+//Frames the idle loop keeps zeroed ahead of time for new heap and stack pages.
+#define ZERO_POOL_SIZE 32
+
+/* Zero one frame into the pool; called from the scheduler's idle loop */
+int vm_idle(void);
+
+/*****************LARGE PAGES*************************/
+
+//The r3000 TLB only maps 4K pages, so a large page is an aligned run of
+//LPAGE_PAGES pages backed by one contiguous block of frames. One fault maps
+//the whole run, and a TLB miss on any page of it loads the rest too. Only heap
+//and anonymous mmap() pages are mapped this way, and only where a whole run
+//fits in the region and none of it has been touched yet. Pages that are
+//swapped out come back as ordinary pages.
+#define LPAGE_ORDER 4
+#define LPAGE_PAGES (1 << LPAGE_ORDER)
+#define LPAGE_SIZE (LPAGE_PAGES * PAGE_SIZE)
+
+/* Query or change whether new runs are set up; default from "options largepages" */
+int vm_getlargepages(void);
+void vm_setlargepages(int on);
+
+/*****************READ-AHEAD*************************/
+
+//A text or data fault loads up to this many pages from the executable in one
+//read. The window starts at READAHEAD_MIN pages and doubles on every fault
+//that lands right after the previous window, up to READAHEAD_MAX.
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 32
+
 /*****************MEMORY SEGMENT STRUCTURE*************************/
 
 //hold info for a segment in memory.
@@ -84,8 +184,8 @@ struct segment{
 };
 
 typedef struct segment segment;
-typedef struct page_table_entry *stack;
-typedef struct page_table_entry *heap;
+typedef page_table_entry *stack;
+typedef page_table_entry *heap;
 
 /***************TLB & Page Fault Handler*********************/
 
@@ -101,4 +201,39 @@ typedef struct page_table_entry *heap;
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/* Fast refill for TLB misses on resident pages, tried before vm_fault */
+int vm_tlbrefill(int faulttype, vaddr_t faultaddress);
+
+/*****************STATISTICS*************************/
+
+//Event counters for the VM system, kept in vmstats.c. Only ever touched at
+//splhigh.
+
+struct vmstats {
+  u_int32_t vs_tlb_misses;    //TLB miss exceptions (load or store)
+  u_int32_t vs_tlb_fast;      //  ...refilled by vm_tlbrefill
+  u_int32_t vs_tlb_slow;      //  ...passed on to vm_fault
+  u_int32_t vs_tlb_readonly;  //TLB modify exceptions
+  u_int32_t vs_tlb_evictions; //valid TLB entries displaced by a refill
+  u_int32_t vs_tlb_prefills;  //pages of a large page loaded along with a miss
+  u_int32_t vs_faults;        //calls to vm_fault
+  u_int32_t vs_zero_fills;    //heap and stack pages given a zeroed frame
+  u_int32_t vs_zero_pool;     //  ...taken from the pre-zeroed pool
+  u_int32_t vs_zero_sync;     //  ...zeroed on the fault path
+  u_int32_t vs_zero_maps;     //heap and stack pages read first and mapped to the zero frame
+  u_int32_t vs_lpage_runs;    //large pages mapped (LPAGE_PAGES zero-fills each)
+  u_int32_t vs_elf_loads;     //text and data faults read from the executable
+  u_int32_t vs_elf_readahead; //  ...extra pages loaded along with them
+  u_int32_t vs_mmap_reads;    //pages of mmap()ed files read in
+  u_int32_t vs_pcache_hits;   //text pages mapped from the page cache
+  u_int32_t vs_cow_copies;    //copy-on-write pages duplicated
+  u_int32_t vs_swap_ins;      //pages read back from swap
+  u_int32_t vs_swap_outs;     //pages written to swap
+};
+
+extern struct vmstats vmstats;
+
+void vmstats_print(void);
+void vmstats_reset(void);
+
 #endif /* _VM_H_ */
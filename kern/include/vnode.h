@@ -106,9 +106,10 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check that the file can be mapped into memory.
+ *                      The VM system pages mapped files in itself with
+ *                      vop_read, so this only has to refuse objects
+ *                      (devices, directories) where that won't work.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
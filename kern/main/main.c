@@ -45,6 +45,8 @@ static
 void
 boot(void)
 {
+	int result;
+
 	/*
 	 * The order of these is important!
 	 * Don't go changing it without thinking about the consequences.
@@ -80,6 +82,12 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 
+	/* Keep a reserve of free frames so faults don't wait on swap. */
+	result = thread_fork("pageout", NULL, 0, pageout_thread, NULL);
+	if (result) {
+		panic("boot: can't start pageout thread: %s\n", strerror(result));
+	}
+
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
 
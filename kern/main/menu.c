@@ -19,6 +19,9 @@
 #include "opt-net.h"
 #include <synch.h>
 #include <process.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <machine/spl.h>
 
 #define _PATH_SHELL "/bin/sh"
 
@@ -79,6 +82,7 @@ cmd_progthread(void *ptr, unsigned long nargs)
 
 	menu_thread = curthread;
 	menu_thread->t_proc = process_bootstrap();
+	menu_thread->t_proc->p_thread = menu_thread;
 
 	result = runprogram(progname, args, nargs);
 
@@ -368,6 +372,100 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for dumping the VM statistics. "vs reset" clears them
+ * afterwards, to measure the next run on its own.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	if (nargs > 2 || (nargs == 2 && strcmp(args[1], "reset"))) {
+		kprintf("Usage: vs [reset]\n");
+		return EINVAL;
+	}
+
+	vmstats_print();
+
+	if (nargs == 2) {
+		vmstats_reset();
+		kprintf("VM statistics reset\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Command for listing processes with their memory footprint, in pages.
+ * Processes that have exited but not been waited for show as <exited>.
+ */
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	struct proc_info *proc;
+	struct thread *t;
+	u_int32_t resident, shared, swapped;
+	u_int32_t tresident = 0, tshared = 0, tswapped = 0;
+	char name[16];
+	pid_t ppid;
+	unsigned j;
+	int i, spl;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: ps\n");
+		return EINVAL;
+	}
+
+	kprintf("  PID  PPID  RESIDENT    SHARED   SWAPPED  NAME\n");
+
+	for (i=0; i<MAX_PID; i++) {
+
+		/* Take a snapshot; the process may exit while we print. */
+		spl = splhigh();
+
+		proc = process_table[i];
+		if (proc == NULL) {
+			splx(spl);
+			continue;
+		}
+
+		ppid = proc->parent_pid;
+		resident = shared = swapped = 0;
+		t = proc->p_thread;
+		if (t == NULL) {
+			strcpy(name, "<exited>");
+		}
+		else {
+			for (j=0; j<sizeof(name)-1 && t->t_name[j]; j++) {
+				name[j] = t->t_name[j];
+			}
+			name[j] = 0;
+			if (t->t_vmspace != NULL) {
+				resident = t->t_vmspace->as_resident;
+				shared = t->t_vmspace->as_shared;
+				swapped = t->t_vmspace->as_swapped;
+			}
+		}
+
+		splx(spl);
+
+		kprintf("%5d %5d %9u %9u %9u  %s\n", i + 1, ppid,
+			resident, shared, swapped, name);
+
+		tresident += resident;
+		tshared += shared;
+		tswapped += swapped;
+	}
+
+	kprintf("Total       %9u %9u %9u  (%u KB resident)\n",
+		tresident, tshared, tswapped, tresident * (PAGE_SIZE / 1024));
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -433,17 +531,26 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Wait channel benchmark        ",
+	"[tt5] Scheduler latency benchmark   ",
+	"[tt6] Stride scheduling test        ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Producer/consumer test (1)    ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress        (4)     ",
 	"[fs3] FS write stress       (4)     ",
 	"[fs4] FS write stress 2     (4)     ",
 	"[fs5] FS create stress      (4)     ",
+	"[vm1] Exit latency benchmark        ",
+	"[vm2] Fault throughput benchmark    ",
+	"[vm3] TLB replacement benchmark     ",
+	"[vm4] mmap/munmap test [file]       ",
+	"[vm5] Large page benchmark          ",
 	NULL
 };
 
@@ -473,6 +580,8 @@ static const char *mainmenu[] = {
 	"[1c] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+	"[vs] VM stats (vs reset to clear)   ",
+	"[ps] Processes and memory use       ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -754,6 +863,8 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "vs",         cmd_vmstats },
+	{ "ps",         cmd_ps },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -767,11 +878,15 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	wchanbench },
+	{ "tt5",	schedbench },
+	{ "tt6",	stridetest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	pctest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -780,6 +895,13 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	createstress },
 
+	/* vm benchmarks */
+	{ "vm1",	exitbench },
+	{ "vm2",	faultbench },
+	{ "vm3",	tlbbench },
+	{ "vm4",	mmaptest },
+	{ "vm5",	lpagebench },
+
 	{ NULL, NULL }
 };
 
@@ -0,0 +1,301 @@
+/*
+ * Scheduler tests.
+ *
+ * schedbench: a handful of threads spin on the CPU while one more
+ * thread, standing in for an interactive program, repeatedly sleeps on
+ * a semaphore. One of the spinners wakes it now and then and notes the
+ * time; the sleeper measures how long it took to get the CPU back. With
+ * one round-robin run queue that is a quantum per spinner; with the
+ * mlfq scheduler the sleeper should run at the next clock tick.
+ *
+ * stridetest: threads holding different numbers of tickets spin side
+ * by side for a few seconds, counting. With the stride scheduler each
+ * one's share of the total count should match its share of the tickets.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <curthread.h>
+#include <test.h>
+#include <process.h>
+#include <scheduler.h>
+#include <machine/spl.h>
+#include "opt-stride.h"
+
+#define SCHED_SPINNERS  8
+#define SCHED_SAMPLES   20
+#define SCHED_WAKESPIN  20000
+
+static struct semaphore *wakesem, *donesem;
+
+/* Set (at splhigh) while the sleeper is waiting on wakesem. */
+static volatile int sleeper_waiting;
+static volatile int spinners_stop;
+static time_t wake_s;
+static u_int32_t wake_ns;
+
+/* Microseconds from each wakeup until the sleeper ran. */
+static u_int32_t latencies[SCHED_SAMPLES];
+
+static
+void
+spinner(void *junk, unsigned long num)
+{
+	volatile unsigned long count = 0;
+	int spl;
+
+	(void)junk;
+
+	while (!spinners_stop) {
+		count++;
+		if (num != 0 || count % SCHED_WAKESPIN != 0) {
+			continue;
+		}
+
+		spl = splhigh();
+		if (sleeper_waiting) {
+			sleeper_waiting = 0;
+			gettime(&wake_s, &wake_ns);
+			V(wakesem);
+		}
+		splx(spl);
+	}
+	V(donesem);
+}
+
+static
+void
+sleeper(void *junk, unsigned long junk2)
+{
+	time_t s, secs;
+	u_int32_t ns, nsecs;
+	int i, spl;
+
+	(void)junk;
+	(void)junk2;
+
+	for (i=0; i<SCHED_SAMPLES; i++) {
+		spl = splhigh();
+		sleeper_waiting = 1;
+		P(wakesem);
+		splx(spl);
+
+		gettime(&s, &ns);
+		getinterval(wake_s, wake_ns, s, ns, &secs, &nsecs);
+		latencies[i] = secs * 1000000 + nsecs / 1000;
+	}
+
+	spinners_stop = 1;
+	V(donesem);
+}
+
+int
+schedbench(int nargs, char **args)
+{
+	u_int32_t total, max;
+	int i, started, result;
+
+	(void)nargs;
+	(void)args;
+
+	wakesem = sem_create("wakesem", 0);
+	donesem = sem_create("donesem", 0);
+	if (wakesem == NULL || donesem == NULL) {
+		panic("schedbench: sem_create failed\n");
+	}
+	sleeper_waiting = 0;
+	spinners_stop = 0;
+
+	kprintf("Starting scheduler latency benchmark (%d spinners)...\n",
+		SCHED_SPINNERS);
+
+	for (started=0; started<SCHED_SPINNERS; started++) {
+		result = thread_fork("sched spinner", NULL, started,
+				     spinner, NULL);
+		if (result) {
+			kprintf("schedbench: thread_fork failed: %s\n",
+				strerror(result));
+			break;
+		}
+	}
+
+	result = EINVAL;
+	if (started > 0) {
+		result = thread_fork("sched sleeper", NULL, 0, sleeper, NULL);
+		if (result) {
+			kprintf("schedbench: thread_fork failed: %s\n",
+				strerror(result));
+		}
+	}
+	if (result) {
+		spinners_stop = 1;
+	}
+	else {
+		P(donesem);
+	}
+
+	for (i=0; i<started; i++) {
+		P(donesem);
+	}
+
+	if (result == 0) {
+		total = max = 0;
+		for (i=0; i<SCHED_SAMPLES; i++) {
+			total += latencies[i];
+			if (latencies[i] > max) {
+				max = latencies[i];
+			}
+		}
+		kprintf("  wakeup latency: %u us average, %u us worst\n",
+			total / SCHED_SAMPLES, max);
+	}
+
+	sem_destroy(donesem);
+	sem_destroy(wakesem);
+
+	kprintf("Scheduler latency benchmark done\n");
+	return result;
+}
+
+#define STRIDE_WORKERS    3
+#define STRIDE_SECONDS    3
+#define STRIDE_TOLERANCE  10	/* percent of the expected share */
+
+static const int stride_tickets[STRIDE_WORKERS] = { 100, 200, 300 };
+
+static volatile int stride_stop;
+static u_int32_t stride_counts[STRIDE_WORKERS];
+
+static
+void
+stride_worker(void *junk, unsigned long num)
+{
+	volatile u_int32_t count = 0;
+	int spl;
+
+	(void)junk;
+
+	while (!stride_stop) {
+		count++;
+	}
+	stride_counts[num] = count;
+
+	/* The proc_info belongs to stridetest, which frees it. */
+	spl = splhigh();
+	curthread->t_proc->p_thread = NULL;
+	curthread->t_proc = NULL;
+	V(donesem);
+	splx(spl);
+}
+
+int
+stridetest(int nargs, char **args)
+{
+	struct proc_info *procs[STRIDE_WORKERS];
+	struct thread *t;
+	u_int32_t sum, unit, share, expected, diff;
+	int i, started, result, failed, spl, tickets;
+
+	(void)nargs;
+	(void)args;
+
+	donesem = sem_create("donesem", 0);
+	if (donesem == NULL) {
+		panic("stridetest: sem_create failed\n");
+	}
+	stride_stop = 0;
+
+	kprintf("Starting stride scheduling test (%d seconds)...\n",
+		STRIDE_SECONDS);
+
+	/*
+	 * Each worker needs a process to hold its tickets, and must have
+	 * it before it first runs; start them all before any of them can.
+	 */
+	result = 0;
+	spl = splhigh();
+	for (started=0; started<STRIDE_WORKERS; started++) {
+		/* NULL if out of memory or the process table is full. */
+		procs[started] = proc_create();
+		if (procs[started] == NULL) {
+			result = ENOMEM;
+			break;
+		}
+		/* Menu commands normally run in a thread with no process. */
+		procs[started]->parent_pid = curthread->t_proc != NULL ?
+			curthread->t_proc->pid : 0;
+		procs[started]->p_tickets = stride_tickets[started];
+
+		result = thread_fork("stride worker", NULL, started,
+				     stride_worker, &t);
+		if (result) {
+			proc_destroy(procs[started]);
+			break;
+		}
+		t->t_proc = procs[started];
+		procs[started]->p_thread = t;
+	}
+	splx(spl);
+
+	if (result) {
+		kprintf("stridetest: could not start worker: %s\n",
+			strerror(result));
+	}
+	else {
+		clocksleep(STRIDE_SECONDS);
+	}
+	stride_stop = 1;
+
+	for (i=0; i<started; i++) {
+		P(donesem);
+		proc_destroy(procs[i]);
+	}
+	sem_destroy(donesem);
+
+	if (result) {
+		return result;
+	}
+
+	sum = 0;
+	tickets = 0;
+	for (i=0; i<STRIDE_WORKERS; i++) {
+		sum += stride_counts[i];
+		tickets += stride_tickets[i];
+	}
+	unit = sum / 1000;
+	if (unit == 0) {
+		unit = 1;
+	}
+
+	failed = 0;
+	for (i=0; i<STRIDE_WORKERS; i++) {
+		share = stride_counts[i] / unit;
+		expected = stride_tickets[i] * 1000 / tickets;
+		diff = share > expected ? share - expected : expected - share;
+		kprintf("  %4d tickets: %10u loops, %3u.%u%% of CPU "
+			"(want %3u.%u%%)\n", stride_tickets[i],
+			stride_counts[i], share / 10, share % 10,
+			expected / 10, expected % 10);
+		if (diff * 100 > expected * STRIDE_TOLERANCE) {
+			failed = 1;
+		}
+	}
+
+#if OPT_STRIDE
+	if (failed) {
+		kprintf("stridetest: shares off by more than %d%%\n",
+			STRIDE_TOLERANCE);
+		return EINVAL;
+	}
+#else
+	(void)failed;
+	kprintf("stridetest: not built with options stride; "
+		"shares not checked\n");
+#endif
+
+	kprintf("Stride scheduling test done\n");
+	return 0;
+}
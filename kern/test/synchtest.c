@@ -3,6 +3,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
 #include <thread.h>
@@ -14,6 +15,11 @@
 #define NCVLOOPS      5
 #define NTHREADS      32
 
+/* Producer/consumer test: NPCTHREADS of each, over a PCBUFSIZE-slot buffer. */
+#define NPCTHREADS    4
+#define NPCITEMS      250
+#define PCBUFSIZE     4
+
 static volatile unsigned long testval1;
 static volatile unsigned long testval2;
 static volatile unsigned long testval3;
@@ -273,3 +279,113 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Producer/consumer with a bounded buffer, woken with cv_signal only.
+ * Each producer and each consumer moves NPCITEMS items. If a signal
+ * is ever lost, some thread sleeps forever and the test never finishes.
+ */
+
+static unsigned long pcbuf[PCBUFSIZE];
+static volatile int pchead, pccount;
+static volatile unsigned long pcsum;
+static struct cv *pcnotfull, *pcnotempty;
+
+static
+void
+producerthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NPCITEMS; i++) {
+		lock_acquire(testlock);
+		while (pccount == PCBUFSIZE) {
+			cv_wait(pcnotfull, testlock);
+		}
+		pcbuf[(pchead + pccount) % PCBUFSIZE] = num * NPCITEMS + i;
+		pccount++;
+		cv_signal(pcnotempty, testlock);
+		lock_release(testlock);
+	}
+	V(donesem);
+}
+
+static
+void
+consumerthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NPCITEMS; i++) {
+		lock_acquire(testlock);
+		while (pccount == 0) {
+			cv_wait(pcnotempty, testlock);
+		}
+		pcsum += pcbuf[pchead];
+		pchead = (pchead + 1) % PCBUFSIZE;
+		pccount--;
+		cv_signal(pcnotfull, testlock);
+		lock_release(testlock);
+	}
+	V(donesem);
+}
+
+int
+pctest(int nargs, char **args)
+{
+	unsigned long n, want;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (pcnotfull==NULL) {
+		pcnotfull = cv_create("pcnotfull");
+		pcnotempty = cv_create("pcnotempty");
+		if (pcnotfull == NULL || pcnotempty == NULL) {
+			panic("pctest: cv_create failed\n");
+		}
+	}
+
+	kprintf("Starting producer/consumer test...\n");
+
+	pchead = pccount = 0;
+	pcsum = 0;
+
+	for (i=0; i<NPCTHREADS; i++) {
+		result = thread_fork("producer", NULL, i, producerthread,
+				     NULL);
+		if (result) {
+			panic("pctest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		result = thread_fork("consumer", NULL, i, consumerthread,
+				     NULL);
+		if (result) {
+			panic("pctest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<2*NPCTHREADS; i++) {
+		P(donesem);
+	}
+
+	/* Every item 0 .. n-1 should have been consumed exactly once. */
+	n = NPCTHREADS * NPCITEMS;
+	want = n * (n - 1) / 2;
+	if (pccount != 0 || pcsum != want) {
+		kprintf("pctest: consumed sum %lu, expected %lu (%d left)\n",
+			pcsum, want, pccount);
+		kprintf("Test failed\n");
+		return EINVAL;
+	}
+
+	kprintf("Producer/consumer test done\n");
+	return 0;
+}
@@ -0,0 +1,594 @@
+/*
+ * VM benchmarks.
+ *
+ * These build throwaway user address spaces from a kernel thread and
+ * touch their pages with copyout(), so the faults go through the real
+ * vm_fault() path without needing a user program on disk.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <curthread.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <uio.h>
+#include <kern/unistd.h>
+#include <kern/stat.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <machine/tlb.h>
+#include <test.h>
+
+/* Where the benchmark heap lives in the scratch address space. */
+#define BENCH_HEAPBASE  0x10000000
+
+/* Resident set sizes (in pages) used by the exit latency benchmark. */
+#define NEXITSIZES 5
+static const int exitsizes[NEXITSIZES] = { 1, 16, 64, 256, 1024 };
+
+#define EXIT_ITERS 8
+
+/* Sizes (in pages) and repetitions for the fault throughput benchmark. */
+#define NFAULTSIZES 3
+static const int faultsizes[NFAULTSIZES] = { 16, 256, 1024 };
+
+#define FAULT_ITERS 4
+
+/*
+ * TLB replacement benchmark: a loop that keeps coming back to a few
+ * stack pages while streaming over more heap pages than the TLB holds.
+ */
+#define TLB_HOTPAGES    8
+#define TLB_STREAMPAGES 96
+#define TLB_ROUNDS      16
+
+/*
+ * Large page benchmark: sweep sequentially over a heap array several
+ * times the TLB's reach, a few times over.
+ */
+#define LPAGE_BENCHPAGES 256
+#define LPAGE_SWEEPS     8
+
+/* Size of the anonymous mapping mmaptest punches a hole in. */
+#define MMAP_TESTPAGES  8
+
+/*
+ * Create an address space with a heap of NPAGES pages, make it current
+ * and fault every page in. Returns NULL if memory ran out.
+ */
+static
+struct addrspace *
+bench_as_populate(int npages)
+{
+	struct addrspace *as;
+	u_int32_t word = 0;
+	int i, result;
+
+	as = as_create();
+	if (as == NULL) {
+		return NULL;
+	}
+
+	as->memory_segments[HEAP].v_base = BENCH_HEAPBASE;
+	as->memory_segments[HEAP].permissions = PF_R | PF_W;
+	as->as_brk = BENCH_HEAPBASE + npages * PAGE_SIZE;
+	as->heap_max = as->as_brk;
+
+	curthread->t_vmspace = as;
+	as_activate(as);
+
+	for (i=0; i<npages; i++) {
+		result = copyout(&word,
+				 (userptr_t)(BENCH_HEAPBASE + i*PAGE_SIZE),
+				 sizeof(word));
+		if (result) {
+			curthread->t_vmspace = NULL;
+			as_destroy(as);
+			return NULL;
+		}
+	}
+
+	curthread->t_vmspace = NULL;
+	return as;
+}
+
+static
+u_int32_t
+elapsed_ns(time_t s1, u_int32_t ns1, time_t s2, u_int32_t ns2)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+	return secs * 1000000000 + nsecs;
+}
+
+/*
+ * Exit latency: time as_destroy() for address spaces of increasing
+ * resident size. For comparison, also time a pass over the whole
+ * coremap looking for frames owned by the address space, which is what
+ * teardown used to cost regardless of how small the process was.
+ */
+int
+exitbench(int nargs, char **args)
+{
+	struct addrspace *as;
+	time_t s1, s2;
+	u_int32_t ns1, ns2, destroyns, scanns, i;
+	volatile u_int32_t found;
+	int size, iter;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting exit latency benchmark (%u frames of RAM)...\n",
+		total_coremap_entries);
+
+	for (size=0; size<NEXITSIZES; size++) {
+
+		if ((u_int32_t)exitsizes[size] * 2 > num_free_coremap_entries) {
+			kprintf("  %4d pages: skipped, not enough memory\n",
+				exitsizes[size]);
+			continue;
+		}
+
+		destroyns = scanns = 0;
+
+		for (iter=0; iter<EXIT_ITERS; iter++) {
+			as = bench_as_populate(exitsizes[size]);
+			if (as == NULL) {
+				kprintf("exitbench: out of memory\n");
+				return ENOMEM;
+			}
+
+			gettime(&s1, &ns1);
+			found = 0;
+			for (i=0; i<total_coremap_entries; i++) {
+				if (coremap[i].as == as) {
+					found++;
+				}
+			}
+			gettime(&s2, &ns2);
+			scanns += elapsed_ns(s1, ns1, s2, ns2);
+
+			gettime(&s1, &ns1);
+			as_destroy(as);
+			gettime(&s2, &ns2);
+			destroyns += elapsed_ns(s1, ns1, s2, ns2);
+		}
+
+		kprintf("  %4d pages: as_destroy %8u ns, "
+			"coremap scan %8u ns\n", exitsizes[size],
+			destroyns / EXIT_ITERS, scanns / EXIT_ITERS);
+	}
+
+	/* Back to no address space; stale entries keep their dead ASIDs. */
+	as_activate(NULL);
+
+	kprintf("Exit latency benchmark done\n");
+	return 0;
+}
+
+/*
+ * Fault throughput: fault in heaps of increasing size and report the
+ * average time per fault, plus how many frames went to page tables and
+ * other bookkeeping on top of the pages themselves.
+ */
+int
+faultbench(int nargs, char **args)
+{
+	struct addrspace *as;
+	time_t s1, s2;
+	u_int32_t ns1, ns2, faultns, before, overhead;
+	int size, iter;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting fault throughput benchmark...\n");
+
+	for (size=0; size<NFAULTSIZES; size++) {
+
+		if ((u_int32_t)faultsizes[size] * 2 > num_free_coremap_entries) {
+			kprintf("  %4d pages: skipped, not enough memory\n",
+				faultsizes[size]);
+			continue;
+		}
+
+		faultns = overhead = 0;
+
+		for (iter=0; iter<FAULT_ITERS; iter++) {
+			before = num_free_coremap_entries;
+
+			gettime(&s1, &ns1);
+			as = bench_as_populate(faultsizes[size]);
+			gettime(&s2, &ns2);
+
+			if (as == NULL) {
+				kprintf("faultbench: out of memory\n");
+				return ENOMEM;
+			}
+
+			faultns += elapsed_ns(s1, ns1, s2, ns2);
+			overhead += before - num_free_coremap_entries
+				- faultsizes[size];
+
+			as_destroy(as);
+		}
+
+		kprintf("  %4d pages: %6u ns/fault, %3u overhead frames\n",
+			faultsizes[size],
+			faultns / (FAULT_ITERS * faultsizes[size]),
+			overhead / FAULT_ITERS);
+	}
+
+	as_activate(NULL);
+
+	kprintf("Fault throughput benchmark done\n");
+	return 0;
+}
+
+/*
+ * One run of the TLB benchmark loop under POLICY. Returns the number of
+ * TLB misses it took, or -1 if memory ran out.
+ */
+static
+int
+tlbbench_run(int policy, u_int32_t *ns)
+{
+	struct addrspace *as;
+	time_t s1, s2;
+	u_int32_t ns1, ns2, misses, word = 0;
+	vaddr_t hot;
+	int round, i, j;
+
+	as = bench_as_populate(TLB_STREAMPAGES);
+	if (as == NULL) {
+		return -1;
+	}
+
+	tlb_setpolicy(policy);
+
+	curthread->t_vmspace = as;
+	as_activate(as);
+
+	misses = vmstats.vs_tlb_misses;
+	gettime(&s1, &ns1);
+
+	for (round=0; round<TLB_ROUNDS; round++) {
+		for (i=0; i<TLB_STREAMPAGES; i++) {
+			for (j=0; j<TLB_HOTPAGES; j++) {
+				hot = USERSTACK - (j+1)*PAGE_SIZE;
+				if (copyout(&word, (userptr_t)hot, sizeof(word))) {
+					goto fail;
+				}
+			}
+			if (copyin((const_userptr_t)(BENCH_HEAPBASE + i*PAGE_SIZE),
+				   &word, sizeof(word))) {
+				goto fail;
+			}
+		}
+	}
+
+	gettime(&s2, &ns2);
+	*ns = elapsed_ns(s1, ns1, s2, ns2);
+	misses = vmstats.vs_tlb_misses - misses;
+
+	curthread->t_vmspace = NULL;
+	as_destroy(as);
+	return misses;
+
+ fail:
+	curthread->t_vmspace = NULL;
+	as_destroy(as);
+	return -1;
+}
+
+/*
+ * TLB replacement: run the same loop under tlbwr and under the clock
+ * with text/stack pinning, and compare the miss counts.
+ */
+int
+tlbbench(int nargs, char **args)
+{
+	static const char *names[2] = { "random", "clock " };
+	int policies[2] = { TLB_POLICY_RANDOM, TLB_POLICY_CLOCK };
+	int oldpolicy, misses, p;
+	u_int32_t ns;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting TLB replacement benchmark (%d hot pages, "
+		"%d streamed, %d TLB slots)...\n", TLB_HOTPAGES,
+		TLB_STREAMPAGES, NUM_TLB);
+
+	oldpolicy = tlb_getpolicy();
+
+	for (p=0; p<2; p++) {
+		misses = tlbbench_run(policies[p], &ns);
+		if (misses < 0) {
+			kprintf("tlbbench: out of memory\n");
+			tlb_setpolicy(oldpolicy);
+			as_activate(NULL);
+			return ENOMEM;
+		}
+		kprintf("  %s: %7d misses, %10u ns\n", names[p], misses, ns);
+	}
+
+	tlb_setpolicy(oldpolicy);
+	as_activate(NULL);
+
+	kprintf("TLB replacement benchmark done\n");
+	return 0;
+}
+
+/*
+ * Check that page I of an anonymous test mapping at BASE holds I in its
+ * first word, or (if HOLE) that touching it faults.
+ */
+static
+int
+mmaptest_check(vaddr_t base, int i, int hole)
+{
+	u_int32_t word;
+	int result;
+
+	result = copyin((const_userptr_t)(base + i*PAGE_SIZE), &word,
+			sizeof(word));
+	if (hole) {
+		if (result == 0) {
+			kprintf("mmaptest: page %d still mapped after munmap\n",
+				i);
+			return EINVAL;
+		}
+		return 0;
+	}
+	if (result) {
+		kprintf("mmaptest: page %d: %s\n", i, strerror(result));
+		return result;
+	}
+	if (word != (u_int32_t)i) {
+		kprintf("mmaptest: page %d holds %u\n", i, word);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Map FILE (read-only) and compare every page against VOP_READ.
+ */
+static
+int
+mmaptest_file(struct addrspace *as, char *file)
+{
+	static char want[PAGE_SIZE], got[PAGE_SIZE];
+	struct vnode *v;
+	struct stat st;
+	struct uio ku;
+	vaddr_t base;
+	off_t pos;
+	size_t n, i;
+	int result;
+
+	result = vfs_open(file, O_RDONLY, &v);
+	if (result) {
+		kprintf("mmaptest: %s: %s\n", file, strerror(result));
+		return result;
+	}
+
+	result = VOP_STAT(v, &st);
+	if (result == 0 && st.st_size == 0) {
+		result = EINVAL;
+	}
+	if (result == 0) {
+		result = as_mmap(as, st.st_size, PF_R, v, 0, &base);
+	}
+	if (result) {
+		kprintf("mmaptest: mapping %s: %s\n", file, strerror(result));
+		vfs_close(v);
+		return result;
+	}
+
+	for (pos = 0; pos < st.st_size; pos += PAGE_SIZE) {
+		n = st.st_size - pos < PAGE_SIZE ? st.st_size - pos : PAGE_SIZE;
+
+		mk_kuio(&ku, want, n, pos, UIO_READ);
+		result = VOP_READ(v, &ku);
+		if (result == 0) {
+			result = copyin((const_userptr_t)(base + pos), got, n);
+		}
+		for (i=0; result == 0 && i<n; i++) {
+			if (want[i] != got[i]) {
+				break;
+			}
+		}
+		if (result == 0 && i < n) {
+			kprintf("mmaptest: %s differs in page at %d\n",
+				file, (int)pos);
+			result = EINVAL;
+		}
+		if (result) {
+			break;
+		}
+	}
+
+	if (result == 0) {
+		result = as_munmap(as, base, st.st_size);
+	}
+
+	/* The mapping holds its own reference to the file. */
+	vfs_close(v);
+
+	if (result == 0) {
+		kprintf("mmaptest: %s: %d bytes match\n", file, (int)st.st_size);
+	}
+	return result;
+}
+
+/*
+ * mmap/munmap: map anonymous memory, write to it, punch a hole in the
+ * middle with as_munmap and check that both halves survive. With an
+ * argument, also map that file and check its contents.
+ */
+int
+mmaptest(int nargs, char **args)
+{
+	struct addrspace *as;
+	u_int32_t word;
+	vaddr_t base;
+	int i, result;
+
+	if (nargs > 2) {
+		kprintf("Usage: vm4 [file]\n");
+		return EINVAL;
+	}
+
+	kprintf("Starting mmap test...\n");
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	curthread->t_vmspace = as;
+	as_activate(as);
+
+	result = as_mmap(as, MMAP_TESTPAGES * PAGE_SIZE, PF_R | PF_W, NULL, 0,
+			 &base);
+	if (result) {
+		kprintf("mmaptest: as_mmap: %s\n", strerror(result));
+		goto done;
+	}
+
+	for (i=0; i<MMAP_TESTPAGES; i++) {
+		/* Fresh anonymous pages read as zero. */
+		result = copyin((const_userptr_t)(base + i*PAGE_SIZE), &word,
+				sizeof(word));
+		if (result == 0 && word != 0) {
+			kprintf("mmaptest: page %d not zero-filled\n", i);
+			result = EINVAL;
+		}
+		if (result == 0) {
+			word = i;
+			result = copyout(&word,
+					 (userptr_t)(base + i*PAGE_SIZE),
+					 sizeof(word));
+		}
+		if (result) {
+			goto done;
+		}
+	}
+
+	result = as_munmap(as, base + 2*PAGE_SIZE, 2*PAGE_SIZE);
+	if (result) {
+		kprintf("mmaptest: as_munmap: %s\n", strerror(result));
+		goto done;
+	}
+
+	for (i=0; i<MMAP_TESTPAGES; i++) {
+		result = mmaptest_check(base, i, i == 2 || i == 3);
+		if (result) {
+			goto done;
+		}
+	}
+
+	if (nargs == 2) {
+		result = mmaptest_file(as, args[1]);
+	}
+
+ done:
+	curthread->t_vmspace = NULL;
+	as_activate(NULL);
+	as_destroy(as);
+
+	kprintf("mmap test %s\n", result ? "failed" : "done");
+	return result;
+}
+
+/*
+ * Fault in and sweep an array of LPAGE_BENCHPAGES heap pages with large
+ * pages turned on or off. Returns the number of TLB misses, or -1 if
+ * memory ran out.
+ */
+static
+int
+lpagebench_run(int on, u_int32_t *ns)
+{
+	struct addrspace *as;
+	time_t s1, s2;
+	u_int32_t ns1, ns2, misses, word;
+	int sweep, i;
+
+	vm_setlargepages(on);
+
+	misses = vmstats.vs_tlb_misses;
+	gettime(&s1, &ns1);
+
+	as = bench_as_populate(LPAGE_BENCHPAGES);
+	if (as == NULL) {
+		return -1;
+	}
+
+	curthread->t_vmspace = as;
+	as_activate(as);
+
+	for (sweep=0; sweep<LPAGE_SWEEPS; sweep++) {
+		for (i=0; i<LPAGE_BENCHPAGES; i++) {
+			if (copyin((const_userptr_t)(BENCH_HEAPBASE + i*PAGE_SIZE),
+				   &word, sizeof(word))) {
+				curthread->t_vmspace = NULL;
+				as_destroy(as);
+				return -1;
+			}
+		}
+	}
+
+	gettime(&s2, &ns2);
+	*ns = elapsed_ns(s1, ns1, s2, ns2);
+	misses = vmstats.vs_tlb_misses - misses;
+
+	curthread->t_vmspace = NULL;
+	as_destroy(as);
+	return misses;
+}
+
+/*
+ * Large pages: the same sequential sweep mapped a page at a time and in
+ * runs of LPAGE_PAGES, comparing TLB misses.
+ */
+int
+lpagebench(int nargs, char **args)
+{
+	static const char *names[2] = { "4K pages   ", "large pages" };
+	int oldsetting, misses, on;
+	u_int32_t ns;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting large page benchmark (%d pages, %d sweeps, "
+		"%d-page runs)...\n", LPAGE_BENCHPAGES, LPAGE_SWEEPS,
+		LPAGE_PAGES);
+
+	oldsetting = vm_getlargepages();
+
+	for (on=0; on<2; on++) {
+		misses = lpagebench_run(on, &ns);
+		if (misses < 0) {
+			kprintf("lpagebench: out of memory\n");
+			vm_setlargepages(oldsetting);
+			as_activate(NULL);
+			return ENOMEM;
+		}
+		kprintf("  %s: %7d misses, %10u ns\n", names[on], misses, ns);
+	}
+
+	vm_setlargepages(oldsetting);
+	as_activate(NULL);
+
+	kprintf("Large page benchmark done\n");
+	return 0;
+}
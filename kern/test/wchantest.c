@@ -0,0 +1,164 @@
+/*
+ * Wait channel benchmark.
+ *
+ * Two threads bounce a token back and forth through a pair of
+ * semaphores, first on their own and then with a crowd of other threads
+ * asleep on semaphores of their own. Every bounce is a V() that wakes
+ * one sleeper, so this shows what idle sleepers elsewhere in the system
+ * add to the cost of a wakeup.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <test.h>
+#include <machine/spl.h>
+
+#define WCHAN_IDLERS  256
+#define WCHAN_ROUNDS  2000
+
+static struct semaphore *ping, *pong, *idledone, *idlestart;
+static struct semaphore *idlesems[WCHAN_IDLERS];
+
+static
+void
+bouncer(void *junk, unsigned long rounds)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<rounds; i++) {
+		P(ping);
+		V(pong);
+	}
+	V(idledone);
+}
+
+static
+void
+idler(void *junk, unsigned long num)
+{
+	int spl;
+
+	(void)junk;
+
+	/*
+	 * Announce ourselves and go to sleep without letting anyone else
+	 * run in between, so once wchanbench_run has heard from every
+	 * idler they are all asleep on their channels.
+	 */
+	spl = splhigh();
+	V(idlestart);
+	P(idlesems[num]);
+	splx(spl);
+
+	V(idledone);
+}
+
+/*
+ * Time WCHAN_ROUNDS bounces with NIDLE threads asleep. Returns the
+ * time per round trip in ns, or 0 if the threads could not be made.
+ */
+static
+u_int32_t
+wchanbench_run(int nidle)
+{
+	time_t s1, s2, secs;
+	u_int32_t ns1, ns2, nsecs;
+	int i, started, result;
+
+	for (started=0; started<nidle; started++) {
+		result = thread_fork("wchan idler", NULL, started, idler, NULL);
+		if (result) {
+			kprintf("wchanbench: thread_fork failed: %s\n",
+				strerror(result));
+			break;
+		}
+	}
+
+	result = 0;
+	if (started == nidle) {
+		result = thread_fork("wchan bouncer", NULL, WCHAN_ROUNDS,
+				     bouncer, NULL);
+		if (result) {
+			kprintf("wchanbench: thread_fork failed: %s\n",
+				strerror(result));
+		}
+	}
+
+	/* Wait until every idler is asleep before timing anything. */
+	for (i=0; i<started; i++) {
+		P(idlestart);
+	}
+
+	nsecs = 0;
+	if (started == nidle && result == 0) {
+		gettime(&s1, &ns1);
+		for (i=0; i<WCHAN_ROUNDS; i++) {
+			V(ping);
+			P(pong);
+		}
+		gettime(&s2, &ns2);
+
+		getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+		nsecs = secs * (1000000000 / WCHAN_ROUNDS) +
+			nsecs / WCHAN_ROUNDS;
+		P(idledone);
+	}
+
+	for (i=0; i<started; i++) {
+		V(idlesems[i]);
+		P(idledone);
+	}
+
+	return nsecs;
+}
+
+int
+wchanbench(int nargs, char **args)
+{
+	u_int32_t quiet, crowded;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	ping = sem_create("ping", 0);
+	pong = sem_create("pong", 0);
+	idledone = sem_create("idledone", 0);
+	idlestart = sem_create("idlestart", 0);
+	if (ping == NULL || pong == NULL || idledone == NULL ||
+	    idlestart == NULL) {
+		panic("wchanbench: sem_create failed\n");
+	}
+	for (i=0; i<WCHAN_IDLERS; i++) {
+		idlesems[i] = sem_create("idler", 0);
+		if (idlesems[i] == NULL) {
+			panic("wchanbench: sem_create failed\n");
+		}
+	}
+
+	kprintf("Starting wait channel benchmark (%d rounds)...\n",
+		WCHAN_ROUNDS);
+
+	quiet = wchanbench_run(0);
+	crowded = wchanbench_run(WCHAN_IDLERS);
+
+	kprintf("  %3d sleepers: %8u ns per round trip\n", 0, quiet);
+	kprintf("  %3d sleepers: %8u ns per round trip\n", WCHAN_IDLERS,
+		crowded);
+
+	for (i=0; i<WCHAN_IDLERS; i++) {
+		sem_destroy(idlesems[i]);
+	}
+	sem_destroy(idlestart);
+	sem_destroy(idledone);
+	sem_destroy(pong);
+	sem_destroy(ping);
+
+	kprintf("Wait channel benchmark done\n");
+	return 0;
+}
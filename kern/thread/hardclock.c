@@ -3,6 +3,7 @@
 #include <machine/spl.h>
 #include <thread.h>
 #include <clock.h>
+#include <scheduler.h>
 
 /* 
  * The address of lbolt has thread_wakeup called on it once a second.
@@ -29,7 +30,9 @@ hardclock(void)
 		thread_wakeup(&lbolt);
 	}
 
-	thread_yield();
+	if (scheduler_tick()) {
+		thread_yield();
+	}
 }
 
 /*
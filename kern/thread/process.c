@@ -13,6 +13,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <synch.h>
+#include <scheduler.h>
 #include <linked_list.h>
 #include <array.h>
 
@@ -73,8 +74,15 @@ struct proc_info *proc_create() {
 	}
 
 	proc->pid = assign_pid();
+	if (proc->pid == 0) {
+		/* The process table is full. */
+		kfree(proc);
+		return NULL;
+	}
 	proc->wait_sem = sem_create("wait_sem", 0);
 	proc->exit_code = 0;
+	proc->p_thread = NULL;
+	proc->p_tickets = STRIDE_DEFAULT_TICKETS;
 
 	process_table[proc->pid - 1] = proc;
 
@@ -1,23 +1,74 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * Runnable threads wait on one of SCHED_LEVELS round-robin run queues,
+ * chosen by t_priority, and the scheduler always takes the head of the
+ * highest nonempty one. Without the mlfq option there is one level and
+ * this is the original round-robin scheduler.
+ *
+ * With mlfq, priority is feedback from how a thread behaves: CPU hogs
+ * get preempted by the clock and sink, while threads that sleep on
+ * I/O (the console, the disk) rise, so the shell is not kept waiting
+ * behind batch jobs.
+ *
+ * With stride, threads share the CPU in proportion to their process's
+ * tickets instead. Each thread has a pass value that advances by its
+ * stride, STRIDE1 / tickets, for every clock tick it runs, and the
+ * runnable thread with the lowest pass runs next; the run queue is a
+ * binary heap ordered by pass.
+ *
+ * The clock only preempts a thread once its quantum (t_quantum, set
+ * each time it is picked) has run out and another thread is waiting,
+ * so a thread that has the CPU to itself is never switched out.
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <scheduler.h>
 #include <thread.h>
+#include <curthread.h>
+#include <clock.h>
 #include <machine/spl.h>
 #include <queue.h>
+#include <vm.h>
+#include <process.h>
+#include "opt-mlfq.h"
+#include "opt-stride.h"
+
+#if OPT_MLFQ && OPT_STRIDE
+#error "options mlfq and stride cannot be used together"
+#endif
+
+#if OPT_MLFQ
+#define SCHED_LEVELS MLFQ_LEVELS
+#else
+#define SCHED_LEVELS 1
+#endif
 
 /*
  *  Scheduler data
  */
 
-// Queue of runnable threads
-static struct queue *runqueue;
+#if OPT_STRIDE
+// Heap of runnable threads, lowest t_pass at the root
+static struct thread **runheap;
+static int runheap_num, runheap_max;
+
+// Pass of the thread picked most recently. Passes wrap around, but the
+// passes of runnable threads never drift far from this.
+static u_int32_t global_pass;
+
+#define PASS_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+#else
+// Queues of runnable threads, one per priority level
+static struct queue *runqueues[SCHED_LEVELS];
+#endif
+
+#if OPT_MLFQ
+// Clock ticks until the next priority boost
+static int boost_ticks;
+#endif
 
 /*
  * Setup function
@@ -25,10 +76,23 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
+#if OPT_STRIDE
+	runheap_max = 32;
+	runheap = kmalloc(runheap_max * sizeof(struct thread *));
+	if (runheap == NULL) {
 		panic("scheduler: Could not create run queue\n");
 	}
+	runheap_num = 0;
+#else
+	int i;
+
+	for (i=0; i<SCHED_LEVELS; i++) {
+		runqueues[i] = q_create(32);
+		if (runqueues[i] == NULL) {
+			panic("scheduler: Could not create run queue\n");
+		}
+	}
+#endif
 }
 
 /*
@@ -37,12 +101,41 @@ scheduler_bootstrap(void)
  * if you change the scheduler to not require space outside the 
  * thread structure, for instance, this function can reasonably
  * do nothing.
+ *
+ * Any thread can end up on any level, so every queue needs room for
+ * all of them.
  */
 int
 scheduler_preallocate(int nthreads)
 {
+#if OPT_STRIDE
+	struct thread **newheap;
+
+	assert(curspl>0);
+	if (nthreads <= runheap_max) {
+		return 0;
+	}
+	newheap = kmalloc(nthreads * sizeof(struct thread *));
+	if (newheap == NULL) {
+		return ENOMEM;
+	}
+	memcpy(newheap, runheap, runheap_num * sizeof(struct thread *));
+	kfree(runheap);
+	runheap = newheap;
+	runheap_max = nthreads;
+	return 0;
+#else
+	int i, result;
+
 	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+	for (i=0; i<SCHED_LEVELS; i++) {
+		result = q_preallocate(runqueues[i], nthreads);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+#endif
 }
 
 /*
@@ -54,11 +147,22 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	int i;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
-		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+#if OPT_STRIDE
+	for (i=0; i<runheap_num; i++) {
+		kprintf("scheduler: Dropping thread %s.\n", runheap[i]->t_name);
+	}
+	runheap_num = 0;
+#else
+	for (i=0; i<SCHED_LEVELS; i++) {
+		while (!q_empty(runqueues[i])) {
+			struct thread *t = q_remhead(runqueues[i]);
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
 	}
+#endif
 }
 
 /*
@@ -71,11 +175,167 @@ scheduler_killall(void)
 void
 scheduler_shutdown(void)
 {
+#if !OPT_STRIDE
+	int i;
+#endif
+
 	scheduler_killall();
 
 	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
+#if OPT_STRIDE
+	kfree(runheap);
+	runheap = NULL;
+	runheap_max = 0;
+#else
+	for (i=0; i<SCHED_LEVELS; i++) {
+		q_destroy(runqueues[i]);
+		runqueues[i] = NULL;
+	}
+#endif
+}
+
+#if OPT_STRIDE
+/*
+ * Tickets held by T: its process's, or the default for kernel threads
+ * that don't belong to one.
+ */
+static
+u_int32_t
+stride_tickets(struct thread *t)
+{
+	if (t->t_proc != NULL) {
+		return t->t_proc->p_tickets;
+	}
+	return STRIDE_DEFAULT_TICKETS;
+}
+
+/*
+ * Add T to the heap. There is always room (see scheduler_preallocate).
+ */
+static
+void
+runheap_add(struct thread *t)
+{
+	int i, parent;
+
+	assert(runheap_num < runheap_max);
+
+	i = runheap_num++;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!PASS_BEFORE(t->t_pass, runheap[parent]->t_pass)) {
+			break;
+		}
+		runheap[i] = runheap[parent];
+		i = parent;
+	}
+	runheap[i] = t;
+}
+
+/*
+ * Remove and return the thread with the lowest pass, or NULL.
+ */
+static
+struct thread *
+runheap_remmin(void)
+{
+	struct thread *min, *last;
+	int i, child;
+
+	if (runheap_num == 0) {
+		return NULL;
+	}
+
+	min = runheap[0];
+	last = runheap[--runheap_num];
+
+	i = 0;
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= runheap_num) {
+			break;
+		}
+		if (child + 1 < runheap_num &&
+		    PASS_BEFORE(runheap[child+1]->t_pass,
+				runheap[child]->t_pass)) {
+			child++;
+		}
+		if (!PASS_BEFORE(runheap[child]->t_pass, last->t_pass)) {
+			break;
+		}
+		runheap[i] = runheap[child];
+		i = child;
+	}
+	if (runheap_num > 0) {
+		runheap[i] = last;
+	}
+
+	return min;
+}
+#endif
+
+/*
+ * Length in clock ticks of a time slice at priority LEVEL.
+ */
+static
+int
+sched_quantum(int level)
+{
+#if OPT_MLFQ
+	return SCHED_QUANTUM << level;
+#else
+	(void)level;
+	return SCHED_QUANTUM;
+#endif
+}
+
+/*
+ * Return nonzero if a thread is waiting at a level above LEVEL.
+ */
+static
+int
+runnable_above(int level)
+{
+#if OPT_STRIDE
+	return level > 0 && runheap_num > 0;
+#else
+	int i;
+
+	for (i=0; i<level; i++) {
+		if (!q_empty(runqueues[i])) {
+			return 1;
+		}
+	}
+	return 0;
+#endif
+}
+
+/*
+ * Return the highest-priority runnable thread, or NULL if there is
+ * none.
+ */
+static
+struct thread *
+scheduler_pick(void)
+{
+#if OPT_STRIDE
+	struct thread *t;
+
+	t = runheap_remmin();
+	if (t != NULL) {
+		global_pass = t->t_pass;
+	}
+	return t;
+#else
+	int i;
+
+	for (i=0; i<SCHED_LEVELS; i++) {
+		if (!q_empty(runqueues[i])) {
+			return q_remhead(runqueues[i]);
+		}
+	}
+	return NULL;
+#endif
 }
 
 /*
@@ -83,15 +343,21 @@ scheduler_shutdown(void)
  * if there's nothing ready. (Note: cpu_idle must be called in a loop
  * until something's ready - it doesn't know whether the things that
  * wake it up are going to make a thread runnable or not.) 
+ *
+ * Before halting, idle time goes to zeroing frames for the VM system.
  */
 struct thread *
 scheduler(void)
 {
+	struct thread *t;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	while (q_empty(runqueue)) {
-		cpu_idle();
+	while ((t = scheduler_pick()) == NULL) {
+		if (!vm_idle()) {
+			cpu_idle();
+		}
 	}
 
 	// You can actually uncomment this to see what the scheduler's
@@ -100,21 +366,134 @@ scheduler(void)
 	// prohibitive.
 	// 
 	//print_run_queue();
-	
-	return q_remhead(runqueue);
+
+	t->t_quantum = sched_quantum(t->t_priority);
+	return t;
 }
 
 /* 
  * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+ * Add it to the end of the run queue for its priority level.
+ *
+ * With stride, a thread coming back from sleep (or starting) holds its
+ * pass relative to global_pass, so it neither gets credit for the time
+ * it spent away nor loses what it was owed when it left.
  */
 int
 make_runnable(struct thread *t)
 {
 	// meant to be called with interrupts off
 	assert(curspl>0);
+	assert(t->t_priority >= 0 && t->t_priority < SCHED_LEVELS);
+
+#if OPT_STRIDE
+	if (t->t_pass_relative) {
+		t->t_pass += global_pass;
+		t->t_pass_relative = 0;
+	}
+	runheap_add(t);
+	return 0;
+#else
+	return q_addtail(runqueues[t->t_priority], t);
+#endif
+}
+
+#if OPT_MLFQ
+/*
+ * Move every queued thread up to level 0, oldest first within each
+ * level. Level 0 has room for every thread (see scheduler_preallocate)
+ * so this cannot fail.
+ */
+static
+void
+mlfq_boost(void)
+{
+	struct thread *t;
+	int i, result;
+
+	for (i=1; i<SCHED_LEVELS; i++) {
+		while (!q_empty(runqueues[i])) {
+			t = q_remhead(runqueues[i]);
+			t->t_priority = 0;
+			result = q_addtail(runqueues[0], t);
+			assert(result==0);
+		}
+	}
+}
+#endif
+
+/*
+ * Clock tick. Charge it to the running thread. Once its quantum is
+ * used up it drops a level and is preempted if anything else can run;
+ * if nothing can, it carries on with a fresh quantum. Threads asleep
+ * now keep their level through a boost; they are raised when they go
+ * to sleep anyway. With stride, the tick advances the thread's pass.
+ */
+int
+scheduler_tick(void)
+{
+	struct thread *t = curthread;
+
+	assert(curspl>0);
+
+	/* Idle, or the scheduler is running; nothing to preempt. */
+	if (t == NULL) {
+		return 0;
+	}
+
+#if OPT_MLFQ
+	if (++boost_ticks >= MLFQ_BOOST_TICKS) {
+		boost_ticks = 0;
+		mlfq_boost();
+		t->t_priority = 0;
+		if (t->t_quantum > sched_quantum(0)) {
+			t->t_quantum = sched_quantum(0);
+		}
+	}
+#endif
+
+#if OPT_STRIDE
+	t->t_pass += STRIDE1 / stride_tickets(t);
+#endif
+
+	if (--t->t_quantum > 0) {
+		/* Mid-slice; give way only to a higher level. */
+		return runnable_above(t->t_priority);
+	}
+
+#if OPT_MLFQ
+	if (t->t_priority < SCHED_LEVELS-1) {
+		t->t_priority++;
+	}
+#endif
+
+	if (!runnable_above(SCHED_LEVELS)) {
+		t->t_quantum = sched_quantum(t->t_priority);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * A thread that gives up the CPU to wait is most likely waiting for
+ * I/O or for another thread, so raise it a level. With stride, keep
+ * its pass as an offset from global_pass until it is runnable again.
+ */
+void
+scheduler_sleep(struct thread *t)
+{
+	assert(curspl>0);
 
-	return q_addtail(runqueue, t);
+#if OPT_MLFQ
+	if (t->t_priority > 0) {
+		t->t_priority--;
+	}
+#elif OPT_STRIDE
+	t->t_pass -= global_pass;
+	t->t_pass_relative = 1;
+#else
+	(void)t;
+#endif
 }
 
 /*
@@ -126,15 +505,30 @@ print_run_queue(void)
 	/* Turn interrupts off so the whole list prints atomically. */
 	int spl = splhigh();
 
-	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
-		k++;
+#if OPT_STRIDE
+	int i;
+
+	for (i=0; i<runheap_num; i++) {
+		struct thread *t = runheap[i];
+		kprintf("  %2d: [pass %u] %s %p\n", i, t->t_pass - global_pass,
+			t->t_name, t->t_sleepaddr);
+	}
+#else
+	int i,k=0,level;
+
+	for (level=0; level<SCHED_LEVELS; level++) {
+		struct queue *runqueue = runqueues[level];
+
+		i = q_getstart(runqueue);
+		while (i!=q_getend(runqueue)) {
+			struct thread *t = q_getguy(runqueue, i);
+			kprintf("  %2d: [%d] %s %p\n", k, level, t->t_name,
+				t->t_sleepaddr);
+			i=(i+1)%q_getsize(runqueue);
+			k++;
+		}
 	}
+#endif
 	
 	splx(spl);
 }
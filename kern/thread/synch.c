@@ -90,7 +90,13 @@ V(struct semaphore *sem)
 	spl = splhigh();
 	sem->count++;
 	assert(sem->count>0);
-	thread_wakeup(sem);
+
+	/*
+	 * One unit, one waiter. If somebody else gets to the count
+	 * first, the waiter just goes back to sleep; the V() that
+	 * thread eventually does will wake the next one.
+	 */
+	thread_wakeone(sem);
 	splx(spl);
 }
 
@@ -164,7 +170,7 @@ lock_release(struct lock *lock)
 
 	lock->lock_owner = NULL;
 
-	thread_wakeup(lock); //wakeup any thread(s) that were sleeping/waiting for that lock
+	thread_wakeone(lock); //wake the thread that has waited longest for the lock; the rest keep sleeping
 
 	assert (lock->lock_owner == NULL);
 
@@ -198,8 +204,6 @@ cv_create(const char *name)
 		kfree(cv);
 		return NULL;
 	}
-	
-	cv->cv_lock = lock_create(name);
 
 	return cv;
 }
@@ -207,76 +211,62 @@ cv_create(const char *name)
 void
 cv_destroy(struct cv *cv)
 {
+	int spl;
 	assert(cv != NULL);
-	lock_destroy(cv->cv_lock);
+
+	spl = splhigh();
+	assert(thread_hassleepers(cv)==0);
+	splx(spl);
 
 	kfree(cv->name);
 	kfree(cv);
 }
 
-/* Release the supplied lock, go to sleep, and, after waking up again, re-acquire the lock.*/
-
+/*
+ * Release the supplied lock, go to sleep, and, after waking up again,
+ * re-acquire the lock. Interrupts go off before the lock is released,
+ * so a cv_signal from the thread that gets the lock next can't come
+ * in between and find nobody asleep.
+ */
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+	int spl;
+
 	assert((cv != NULL) && (lock != NULL));
 	assert(lock_do_i_hold(lock));
 
-	lock_acquire(cv->cv_lock);	
-
+	spl = splhigh();
 	lock_release(lock);
-
-	lock_release(cv->cv_lock);
-
-	int spl = splhigh();
-
-	thread_sleep(cv);	
-	
+	thread_sleep(cv);
 	splx(spl);
 
-	//lock_acquire(cv->cv_lock);	
-
 	lock_acquire(lock);
-
-	//lock_release(cv->cv_lock);
 }
 
-/* Wake up one thread that's sleeping on this CV. */
-
+/* Wake up the thread that has been sleeping on this CV longest. */
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-	assert((cv != NULL) && (lock != NULL));
-	assert(lock_do_i_hold(lock));	
-
-
-
-	lock_acquire(cv->cv_lock);	
+	int spl;
 
-	int spl = splhigh();
+	assert((cv != NULL) && (lock != NULL));
+	assert(lock_do_i_hold(lock));
 
+	spl = splhigh();
 	thread_wakeone(cv);
-
 	splx(spl);
-
-	lock_release(cv->cv_lock);
-
-
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	assert((cv != NULL) && (lock != NULL));
-	assert(lock_do_i_hold(lock));	
-
-	int spl = splhigh();
-
-	lock_acquire(cv->cv_lock);	
-
-	thread_wakeup(cv);	
+	int spl;
 
-	lock_release(cv->cv_lock);
+	assert((cv != NULL) && (lock != NULL));
+	assert(lock_do_i_hold(lock));
 
+	spl = splhigh();
+	thread_wakeup(cv);
 	splx(spl);
 }
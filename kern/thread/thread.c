@@ -30,8 +30,31 @@ typedef enum {
 /* Global variable for the thread currently executing at any given time. */
 struct thread *curthread;
 
-/* Table of sleeping threads. */
-static struct array *sleepers;
+/*
+ * Wait channels. The threads sleeping on each address are kept on a
+ * FIFO queue of their own, and the queues hang off a small hash table
+ * keyed by the address, so waking the sleepers on an address touches
+ * only those threads (and any other channels on the same hash chain)
+ * rather than every sleeping thread in the system.
+ *
+ * Channel records come from a pool that thread_fork keeps at least as
+ * large as the number of threads. A channel is only open while it has
+ * a sleeper, so the pool can't run dry in mi_switch.
+ */
+#define WCHAN_BUCKETS 64
+
+struct wchan {
+	const void *wc_addr;
+	struct thread *wc_head;		/* oldest sleeper */
+	struct thread *wc_tail;		/* newest sleeper */
+	struct wchan *wc_next;		/* hash chain, or free list */
+};
+
+static struct wchan *wchan_table[WCHAN_BUCKETS];
+static struct wchan *wchan_free;
+
+/* Every channel record, open or free. */
+static struct array *wchan_pool;
 
 /* List of dead threads to be disposed of. */
 static struct array *zombies;
@@ -58,12 +81,20 @@ thread_create(const char *name)
 		return NULL;
 	}
 	thread->t_sleepaddr = NULL;
+	thread->t_wchan_next = NULL;
 	thread->t_stack = NULL;
 
 	thread->t_vmspace = NULL;
 
 	thread->t_cwd = NULL;
 
+	thread->t_proc = NULL;
+
+	thread->t_priority = 0;
+	thread->t_quantum = 0;
+	thread->t_pass = 0;
+	thread->t_pass_relative = 1;
+
 	// If you add things to the thread structure, be sure to initialize
 	// them here.
 
@@ -122,6 +153,122 @@ exorcise(void)
 	assert(result==0);
 }
 
+/*
+ * Hash a sleep address. These are mostly kmalloc'd objects, whose low
+ * bits say little.
+ */
+static
+unsigned
+wchan_hash(const void *addr)
+{
+	return ((u_int32_t)addr >> 4) % WCHAN_BUCKETS;
+}
+
+/*
+ * Grow the pool of channel records to at least N.
+ */
+static
+int
+wchan_preallocate(int n)
+{
+	struct wchan *wc;
+	int result;
+
+	while (array_getnum(wchan_pool) < n) {
+		wc = kmalloc(sizeof(struct wchan));
+		if (wc == NULL) {
+			return ENOMEM;
+		}
+		result = array_add(wchan_pool, wc);
+		if (result) {
+			kfree(wc);
+			return result;
+		}
+		wc->wc_next = wchan_free;
+		wchan_free = wc;
+	}
+	return 0;
+}
+
+/*
+ * Find the open channel for ADDR, or return NULL. If PREVP is not
+ * NULL, the link in the hash chain that points at the channel is
+ * returned through it, for wchan_close.
+ */
+static
+struct wchan *
+wchan_lookup(const void *addr, struct wchan ***prevp)
+{
+	struct wchan **pp;
+
+	for (pp = &wchan_table[wchan_hash(addr)]; *pp != NULL;
+	     pp = &(*pp)->wc_next) {
+		if ((*pp)->wc_addr == addr) {
+			if (prevp != NULL) {
+				*prevp = pp;
+			}
+			return *pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Queue T at the tail of the channel for its sleep address, opening
+ * the channel if T is the first sleeper.
+ */
+static
+void
+wchan_enqueue(struct thread *t)
+{
+	struct wchan *wc;
+	unsigned bucket;
+
+	wc = wchan_lookup(t->t_sleepaddr, NULL);
+	if (wc == NULL) {
+		/*
+		 * Because we preallocate during thread_fork, there is
+		 * always a free record.
+		 */
+		wc = wchan_free;
+		assert(wc != NULL);
+		wchan_free = wc->wc_next;
+
+		wc->wc_addr = t->t_sleepaddr;
+		wc->wc_head = wc->wc_tail = NULL;
+
+		bucket = wchan_hash(t->t_sleepaddr);
+		wc->wc_next = wchan_table[bucket];
+		wchan_table[bucket] = wc;
+	}
+
+	t->t_wchan_next = NULL;
+	if (wc->wc_tail == NULL) {
+		wc->wc_head = t;
+	}
+	else {
+		wc->wc_tail->t_wchan_next = t;
+	}
+	wc->wc_tail = t;
+}
+
+/*
+ * Close the empty channel that *PP points at and return its record to
+ * the pool.
+ */
+static
+void
+wchan_close(struct wchan **pp)
+{
+	struct wchan *wc = *pp;
+
+	assert(wc->wc_head == NULL);
+
+	*pp = wc->wc_next;
+	wc->wc_next = wchan_free;
+	wchan_free = wc;
+}
+
 /*
  * Kill all sleeping threads. This is used during panic shutdown to make
  * sure they don't wake up again and interfere with the panic.
@@ -130,32 +277,38 @@ static
 void
 thread_killall(void)
 {
-	int i, result;
+	struct wchan *wc;
+	struct thread *t;
+	int i;
 
 	assert(curspl>0);
 
 	/*
-	 * Move all sleepers to the zombie list, to be sure they don't
+	 * Empty every wait channel, to be sure the sleepers don't
 	 * wake up while we're shutting down.
 	 */
 
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		kprintf("sleep: Dropping thread %s\n", t->t_name);
-
-		/*
-		 * Don't do this: because these threads haven't
-		 * been through thread_exit, thread_destroy will
-		 * get upset. Just drop the threads on the floor,
-		 * which is safer anyway during panic.
-		 *
-		 * array_add(zombies, t);
-		 */
+	for (i=0; i<WCHAN_BUCKETS; i++) {
+		while (wchan_table[i] != NULL) {
+			wc = wchan_table[i];
+			for (t = wc->wc_head; t != NULL; t = t->t_wchan_next) {
+				kprintf("sleep: Dropping thread %s\n",
+					t->t_name);
+
+				/*
+				 * Don't do this: because these threads
+				 * haven't been through thread_exit,
+				 * thread_destroy will get upset. Just
+				 * drop the threads on the floor, which
+				 * is safer anyway during panic.
+				 *
+				 * array_add(zombies, t);
+				 */
+			}
+			wc->wc_head = wc->wc_tail = NULL;
+			wchan_close(&wchan_table[i]);
+		}
 	}
-
-	result = array_setsize(sleepers, 0);
-	/* shrinking array: not supposed to fail */
-	assert(result==0);
 }
 
 /*
@@ -179,9 +332,9 @@ thread_bootstrap(void)
 	struct thread *me;
 
 	/* Create the data structures we need. */
-	sleepers = array_create();
-	if (sleepers==NULL) {
-		panic("Cannot create sleepers array\n");
+	wchan_pool = array_create();
+	if (wchan_pool==NULL || wchan_preallocate(1)) {
+		panic("Cannot create wait channel pool\n");
 	}
 
 	zombies = array_create();
@@ -229,8 +382,14 @@ thread_bootstrap(void)
 void
 thread_shutdown(void)
 {
-	array_destroy(sleepers);
-	sleepers = NULL;
+	int i;
+
+	for (i=0; i<array_getnum(wchan_pool); i++) {
+		kfree(array_getguy(wchan_pool, i));
+	}
+	array_destroy(wchan_pool);
+	wchan_pool = NULL;
+	wchan_free = NULL;
 	array_destroy(zombies);
 	zombies = NULL;
 	// Don't do this - it frees our stack and we blow up
@@ -291,7 +450,7 @@ thread_fork(const char *name,
 	 * Make sure our data structures have enough space, so we won't
 	 * run out later at an inconvenient time.
 	 */
-	result = array_preallocate(sleepers, numthreads+1);
+	result = wchan_preallocate(numthreads+1);
 	if (result) {
 		goto fail;
 	}
@@ -395,10 +554,11 @@ mi_switch(threadstate_t nextstate)
 	}
 	else if (nextstate==S_SLEEP) {
 		/*
-		 * Because we preallocate sleepers[] during thread_fork,
-		 * this should never fail.
+		 * Because we preallocate channel records during
+		 * thread_fork, this can't fail.
 		 */
-		result = array_add(sleepers, cur);
+		wchan_enqueue(cur);
+		result = 0;
 	}
 	else {
 		assert(nextstate==S_ZOMB);
@@ -463,6 +623,11 @@ thread_exit(void)
 
 	splhigh();
 
+	/* The process is gone as far as ps and memstat are concerned. */
+	if (curthread->t_proc != NULL) {
+		curthread->t_proc->p_thread = NULL;
+	}
+
 	if (curthread->t_vmspace) {
 		/*
 		 * Do this carefully to avoid race condition with
@@ -496,8 +661,8 @@ thread_yield(void)
 {
 	int spl = splhigh();
 
-	/* Check sleepers just in case we get here after shutdown */
-	assert(sleepers != NULL);
+	/* Check the wait channels just in case we get here after shutdown */
+	assert(wchan_pool != NULL);
 
 	mi_switch(S_READY);
 	splx(spl);
@@ -521,6 +686,7 @@ thread_sleep(const void *addr)
 	assert(in_interrupt==0);
 
 	curthread->t_sleepaddr = addr;
+	scheduler_sleep(curthread);
 	mi_switch(S_SLEEP);
 	curthread->t_sleepaddr = NULL;
 }
@@ -532,56 +698,67 @@ thread_sleep(const void *addr)
 void
 thread_wakeup(const void *addr)
 {
-	int i, result;
+	struct wchan *wc, **pp;
+	struct thread *t;
+	int result;
 
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	// This is inefficient. Feel free to improve it.
-
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
+	wc = wchan_lookup(addr, &pp);
+	if (wc == NULL) {
+		return;
+	}
 
-			// Remove from list
-			array_remove(sleepers, i);
+	// Everybody goes, oldest first.
 
-			// must look at the same sleepers[i] again
-			i--;
+	while ((t = wc->wc_head) != NULL) {
+		wc->wc_head = t->t_wchan_next;
+		t->t_wchan_next = NULL;
 
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-		}
+		/*
+		 * Because we preallocate during thread_fork,
+		 * this should never fail.
+		 */
+		result = make_runnable(t);
+		assert(result==0);
 	}
+
+	wc->wc_tail = NULL;
+	wchan_close(pp);
 }
 
 void
 thread_wakeone(const void *addr)
 {
+	struct wchan *wc, **pp;
+	struct thread *t;
 	int result;
 
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	// This is inefficient. Feel free to improve it.
-
-	struct thread *t = array_getguy(sleepers, 0);
-	if (t->t_sleepaddr == addr) {
+	wc = wchan_lookup(addr, &pp);
+	if (wc == NULL) {
+		return;
+	}
 
-		// Remove from list
-		array_remove(sleepers, 0);
+	// Take the oldest sleeper off the channel.
 
-		/*
-		 * Because we preallocate during thread_fork,
-		 * this should never fail.
-		 */
-		result = make_runnable(t);
-		assert(result==0);
+	t = wc->wc_head;
+	wc->wc_head = t->t_wchan_next;
+	t->t_wchan_next = NULL;
+	if (wc->wc_head == NULL) {
+		wc->wc_tail = NULL;
+		wchan_close(pp);
 	}
+
+	/*
+	 * Because we preallocate during thread_fork,
+	 * this should never fail.
+	 */
+	result = make_runnable(t);
+	assert(result==0);
 }
 
 /*
@@ -591,18 +768,10 @@ thread_wakeone(const void *addr)
 int
 thread_hassleepers(const void *addr)
 {
-	int i;
-
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			return 1;
-		}
-	}
-	return 0;
+	return wchan_lookup(addr, NULL) != NULL;
 }
 
 /*
@@ -192,8 +192,17 @@ load_segment(struct vnode *v, off_t offset, vaddr_t vaddr,
 	 			return result;
 	 		}
 
-			(curthread->t_vmspace->as_v).offset[i-1] = ph.p_offset;
-			(curthread->t_vmspace->as_v).filesize[i-1] = ph.p_filesz;
+			/*
+			 * as_define_region rounds the segment down to a page
+			 * boundary; record the file image from that boundary
+			 * too, so page N of the segment is always N pages
+			 * into the file image. (ELF guarantees p_offset and
+			 * p_vaddr agree modulo the page size.)
+			 */
+			(curthread->t_vmspace->as_v).offset[i-1] =
+				ph.p_offset - (ph.p_vaddr & ~(vaddr_t)PAGE_FRAME);
+			(curthread->t_vmspace->as_v).filesize[i-1] =
+				ph.p_filesz + (ph.p_vaddr & ~(vaddr_t)PAGE_FRAME);
  	}
 
  	result = as_prepare_load(curthread->t_vmspace);
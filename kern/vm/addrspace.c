@@ -10,6 +10,11 @@
 #include <array.h>
 #include <elf.h>
 #include <vnode.h>
+#include <vfs.h>
+#include <uio.h>
+#include <swap.h>
+#include <pagecache.h>
+#include "opt-largepages.h"
 
 /*
 * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -22,8 +27,57 @@ u_int32_t coremap_base_page_offset;
 u_int32_t total_coremap_entries;
 u_int32_t num_free_coremap_entries;
 
+//Heads of the buddy allocator's per-order free lists (coremap indices).
+static int buddy_free_list[BUDDY_NUM_ORDERS];
+
+//Next coremap index the page replacement clock will look at.
+static u_int32_t clock_hand;
+
+//Free frame watermarks for the pageout daemon.
+u_int32_t pageout_low;
+u_int32_t pageout_high;
+
+/*TLB address space IDs are handed out in order within a generation. When they
+  run out the TLB is flushed and a new generation starts, which invalidates
+  every address space's ASID at once. ASID 0 is never handed out; it is loaded
+  while no address space is active.*/
+static u_int32_t asid_generation = 1;
+static u_int32_t asid_next = 1;
+
+//A frame of zeros, mapped copy-on-write for heap and stack pages that have
+//been read but never written. Set up by vm_bootstrap(), which keeps one
+//reference on it for good.
+static paddr_t zero_paddr;
+
+//Frames zeroed ahead of time by vm_idle(), ready to back new heap and stack
+//pages. They are allocated as far as the coremap is concerned and are handed
+//back if memory runs out.
+static paddr_t zero_pool[ZERO_POOL_SIZE];
+static u_int32_t zero_pool_count;
+
+//Whether big heap and anonymous mmap() regions get contiguous runs of frames
+//(see LPAGE_PAGES). The default comes from the largepages kernel option;
+//vm_setlargepages() switches at runtime.
+#if OPT_LARGEPAGES
+static int lpage_enabled = 1;
+#else
+static int lpage_enabled = 0;
+#endif
+
 int booted;
 
+static void buddy_free_range(u_int32_t index, u_int32_t npages);
+static struct page_table_entry_array *page_table_L2_create(void);
+static int page_evict(void);
+static void pageout_poke(void);
+static void page_zero(paddr_t paddr);
+static u_int32_t zero_pool_drain(void);
+static int page_in(struct addrspace *as, page_table_entry *PTE, vaddr_t vaddr);
+static void tlb_unmap(struct addrspace *as, vaddr_t vaddr);
+static void tlb_unmap_range(struct addrspace *as, vaddr_t vaddr, u_int32_t npages);
+static void pte_set(struct addrspace *as, page_table_entry *PTE, page_table_entry pte);
+static void as_update_heap_max(struct addrspace *as);
+
 /********************************COREMAP***************************************/
 
 void coremap_bootstrap() {
@@ -87,111 +141,246 @@ void coremap_bootstrap() {
     coremap[i].is_allocated = 0;
     coremap[i].chunk_size = 0;
     coremap[i].as = NULL;
+    coremap[i].refcount = 0;
+    coremap[i].vaddr = 0;
+    coremap[i].pinned = 0;
+    coremap[i].swap_slot = -1;
+    coremap[i].is_free_head = 0;
+    coremap[i].order = 0;
+    coremap[i].buddy_next = -1;
+    coremap[i].buddy_prev = -1;
+  }
+
+  for (i = 0; i < BUDDY_NUM_ORDERS; i++) {
+    buddy_free_list[i] = -1;
   }
 
+  clock_hand = 0;
+
+  pageout_low = total_coremap_entries / PAGEOUT_LOW_DIVISOR + 1;
+  pageout_high = total_coremap_entries / PAGEOUT_HIGH_DIVISOR + 2;
+
+  /*Hand every frame to the buddy allocator. The number of frames is rarely a
+    power of two, so carve the range up into the largest aligned blocks that
+    fit.*/
+  buddy_free_range(0, total_coremap_entries);
+
   splx(spl);
 }
 
-static paddr_t getppages(unsigned long npages)
+/*********************************BUDDY ALLOCATOR*******************************/
+
+/*The coremap doubles as the buddy allocator's block table. A free block of
+  2^k frames starting at index i is recorded on its first entry only
+  (is_free_head, order = k) and sits on buddy_free_list[k]. Blocks are aligned
+  to their own size relative to coremap index 0, so the buddy of the block at
+  i is simply i ^ 2^k.*/
+
+static
+void
+buddy_list_insert(u_int32_t index, int order)
 {
+  coremap[index].is_free_head = 1;
+  coremap[index].order = order;
+  coremap[index].buddy_prev = -1;
+  coremap[index].buddy_next = buddy_free_list[order];
 
-  paddr_t addr;
+  if (buddy_free_list[order] != -1) {
+    coremap[buddy_free_list[order]].buddy_prev = index;
+  }
 
-  int spl = splhigh();
+  buddy_free_list[order] = index;
+}
 
-  unsigned int found_block = 0;
+static
+void
+buddy_list_remove(u_int32_t index)
+{
+  int order = coremap[index].order;
 
-  if (npages > 1) {
+  assert(coremap[index].is_free_head);
 
-    //Multiple pages.
+  if (coremap[index].buddy_prev != -1) {
+    coremap[coremap[index].buddy_prev].buddy_next = coremap[index].buddy_next;
+  }
+  else {
+    buddy_free_list[order] = coremap[index].buddy_next;
+  }
 
-    u_int32_t i;
-    int free_entry_index;
-    unsigned int frame_counter = 1;
+  if (coremap[index].buddy_next != -1) {
+    coremap[coremap[index].buddy_next].buddy_prev = coremap[index].buddy_prev;
+  }
 
-    if (npages > num_free_coremap_entries) {
-      panic("Can't allocate multiple frames.\n");
-      splx(spl);
-      return 0;
-    }
+  coremap[index].is_free_head = 0;
+  coremap[index].buddy_next = -1;
+  coremap[index].buddy_prev = -1;
+}
 
-    for (i = 0; i < total_coremap_entries; i++) {
+//Free a single aligned block of 2^order frames, merging it with its buddy for
+//as long as the buddy is also free and whole.
 
-      /*We are only interested in this frame if the frame next to it is available
-      as well.*/
-      if (!coremap[i].is_allocated && !coremap[i + 1].is_allocated) {
-        frame_counter++;
-      }
-      else {
-        /*The frame next to it is not available, so this isn't the contiguous
-        block that we are looking for.*/
-        frame_counter = 1;
-      }
-      if (frame_counter == npages) {
-        /*Frames found!*/
-        found_block = 1;
-        free_entry_index = i;
-        break;
-      }
+static
+void
+buddy_free_block(u_int32_t index, int order)
+{
+  assert((index & ((1 << order) - 1)) == 0);
+
+  while (order < BUDDY_MAX_ORDER) {
+
+    u_int32_t buddy = index ^ (1 << order);
+
+    if (buddy + (1 << order) > total_coremap_entries) {
+      break;
     }
 
-    if (!found_block) {
-      kprintf("Didn't find suitable block.\n");
-      splx(spl);
-      return 0;
+    if (!coremap[buddy].is_free_head || coremap[buddy].order != order) {
+      break;
+    }
+
+    buddy_list_remove(buddy);
+
+    if (buddy < index) {
+      index = buddy;
     }
+    order++;
+  }
 
-    num_free_coremap_entries -= npages;
+  buddy_list_insert(index, order);
+}
 
-    for (i = free_entry_index; i < (free_entry_index + npages); i++) {
+//Free an arbitrary run of frames by splitting it into aligned power-of-two
+//blocks. Used at boot, for multi-frame chunks and for trimming allocations
+//that were rounded up to a whole block.
 
-      coremap[i].is_allocated = 1;
-      coremap[i].chunk_size = npages;
+static
+void
+buddy_free_range(u_int32_t index, u_int32_t npages)
+{
+  u_int32_t end = index + npages;
 
-      if (booted) {
-        coremap[i].as = curthread->t_vmspace;
-      }
+  while (index < end) {
+
+    int order = 0;
+
+    while (order < BUDDY_MAX_ORDER &&
+           (index & ((2 << order) - 1)) == 0 &&
+           index + (2 << order) <= end) {
+      order++;
     }
 
-    addr = (paddr_t)((free_entry_index * PAGE_SIZE) + coremap_base_page_offset);
+    buddy_free_block(index, order);
+    index += (1 << order);
+  }
+}
 
-    // Must be page aligned.
-    assert((addr & PAGE_FRAME) == addr);
+//Take a run of npages frames off the free lists. Returns the coremap index of
+//the first frame, or -1 if no block is large enough.
 
-    // Check base and bounds for this address to check if its valid.
+static
+int
+buddy_alloc(unsigned long npages)
+{
+  int order = 0;
+  int found;
+  u_int32_t index;
 
+  while ((1UL << order) < npages) {
+    order++;
   }
 
-  else {
+  if (order > BUDDY_MAX_ORDER) {
+    return -1;
+  }
 
-    //Single page.
+  //Smallest non-empty list that can satisfy the request.
 
-    if (num_free_coremap_entries == 0) {
-      panic("Can't allocate single frame.\n");
-      return 0;
+  for (found = order; found < BUDDY_NUM_ORDERS; found++) {
+    if (buddy_free_list[found] != -1) {
+      break;
     }
+  }
+
+  if (found == BUDDY_NUM_ORDERS) {
+    return -1;
+  }
 
-    int free_entry_index = -1;
-    u_int32_t i;
+  index = buddy_free_list[found];
+  buddy_list_remove(index);
 
-    for (i = 0; i < total_coremap_entries && !found_block; i++) {
-      if (!coremap[i].is_allocated) {
-        free_entry_index = i;
-        found_block = 1;
-      }
-    }
+  //Split down to the requested order, returning the upper halves.
+
+  while (found > order) {
+    found--;
+    buddy_list_insert(index + (1 << found), found);
+  }
+
+  //Give back the tail of the block if npages wasn't a power of two.
+
+  if ((1UL << order) > npages) {
+    buddy_free_range(index + npages, (1 << order) - npages);
+  }
+
+  return index;
+}
+
+static paddr_t getppages(unsigned long npages)
+{
+
+  paddr_t addr;
+
+  int spl = splhigh();
+
+  int free_entry_index;
+  u_int32_t i;
+
+  free_entry_index = buddy_alloc(npages);
 
-    coremap[free_entry_index].is_allocated = 1;
-    coremap[free_entry_index].chunk_size = 1;
+  //Out of frames: the pageout daemon has fallen behind. Give back the
+  //pre-zeroed pool and drop unmapped text from the page cache, then push user
+  //pages out to swap ourselves until the request fits. Both can sleep on the
+  //disk, so this can't be done from an interrupt handler or before threads
+  //are up.
 
-    if (booted) {
-      coremap[free_entry_index].as = curthread->t_vmspace;
+  if (free_entry_index < 0) {
+    pageout_poke();
+  }
+
+  if (free_entry_index < 0 && zero_pool_drain() > 0) {
+    free_entry_index = buddy_alloc(npages);
+  }
+
+  while (free_entry_index < 0 && booted && !in_interrupt) {
+
+    if (pcache_reclaim(num_free_coremap_entries + npages) == 0 &&
+        (!swap_enabled() || page_evict())) {
+      break;
     }
 
+    free_entry_index = buddy_alloc(npages);
+  }
+
+  if (free_entry_index < 0) {
+    splx(spl);
+    return 0;
+  }
+
+  num_free_coremap_entries -= npages;
+  pageout_poke();
+
+  for (i = free_entry_index; i < (free_entry_index + npages); i++) {
 
-    addr = (paddr_t)((free_entry_index * PAGE_SIZE) + coremap_base_page_offset);
+    coremap[i].is_allocated = 1;
+    coremap[i].chunk_size = npages;
+
+    //Kernel frames belong to nobody; user frames are tagged by alloc_upage().
+    coremap[i].as = NULL;
   }
 
+  addr = (paddr_t)((free_entry_index * PAGE_SIZE) + coremap_base_page_offset);
+
+  // Must be page aligned.
+  assert((addr & PAGE_FRAME) == addr);
+
 //NOTE: it is possible for invalid physical address being access so need to handle this...
 
   if (addr == (paddr_t)(0x0)) {
@@ -223,47 +412,253 @@ static paddr_t getppages(unsigned long npages)
 
    u_int32_t physical_page_number = (p_addr - coremap_base_page_offset) / PAGE_SIZE;
 
-   if (coremap[physical_page_number].chunk_size == 1) {
-
-     // Freeing a single page.
+   assert(physical_page_number < total_coremap_entries);
+   assert(coremap[physical_page_number].is_allocated);
 
-     coremap[physical_page_number].is_allocated = 0;
-     coremap[physical_page_number].chunk_size = 0;
+   unsigned int length = coremap[physical_page_number].chunk_size;
 
-     if (booted) {
-       coremap[physical_page_number].as = NULL;
-     }
+   unsigned int i;
+   for (i = physical_page_number; i < (length + physical_page_number); i++) {
 
-     num_free_coremap_entries++;
+     coremap[i].is_allocated = 0;
+     coremap[i].chunk_size = 0;
+     coremap[i].as = NULL;
+     coremap[i].refcount = 0;
+     coremap[i].vaddr = 0;
+     coremap[i].pinned = 0;
+     coremap[i].swap_slot = -1;
    }
 
-   else if (coremap[physical_page_number].chunk_size > 1) {
+   //Hand the chunk back to the buddy allocator, which merges it with any free
+   //neighbours.
 
-     // Freeing multiple pages.
+   buddy_free_range(physical_page_number, length);
 
-     unsigned int length = coremap[physical_page_number].chunk_size;
+   num_free_coremap_entries += length;
+   splx(spl);
+ }
 
-     unsigned int i;
-     for (i = physical_page_number; i < (length + physical_page_number); i++) {
+/*Allocate/free a single frame backing a user page. The owning address space
+  and virtual page are recorded in the coremap so the frame can be traced back
+  to its page table entry when it is evicted. free_upage() only drops one
+  reference; the frame goes back to the allocator once no page table maps it
+  any more.
 
-       coremap[i].is_allocated = 0;
-       coremap[i].chunk_size = 0;
+  Frames come back from alloc_upage() pinned, since the caller usually has to
+  fill them and hook them into the page table first (which may sleep). Call
+  page_unpin() once the PTE points at the frame.*/
 
-       if (booted) {
-         coremap[i].as = NULL;
-       }
-     }
+static
+void
+upage_init(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+  u_int32_t index = PADDR_TO_COREMAP_INDEX(paddr);
 
-     num_free_coremap_entries += length;
-     splx(spl);
-   }
+  coremap[index].as = as;
+  coremap[index].vaddr = vaddr;
+  coremap[index].refcount = 1;
+  coremap[index].pinned = 1;
+  coremap[index].swap_slot = -1;
+}
 
-   //NOTE: Need to check for possible errors where free() will fail, need to handle this
+static
+paddr_t
+alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+  paddr_t paddr = getppages(1);
 
- }
+  if (paddr != 0) {
+    upage_init(paddr, as, vaddr);
+  }
+
+  return paddr;
+}
+
+//Same, for a page that has to start out zeroed. Takes a frame from the
+//pre-zeroed pool if there is one, otherwise clears a fresh frame here.
+
+static
+paddr_t
+alloc_upage_zeroed(struct addrspace *as, vaddr_t vaddr)
+{
+  paddr_t paddr;
+  int spl = splhigh();
+
+  if (zero_pool_count > 0) {
+    paddr = zero_pool[--zero_pool_count];
+    upage_init(paddr, as, vaddr);
+    vmstats.vs_zero_pool++;
+  }
+  else {
+    paddr = alloc_upage(as, vaddr);
+    if (paddr == 0) {
+      splx(spl);
+      return 0;
+    }
+    page_zero(paddr);
+    vmstats.vs_zero_sync++;
+  }
+
+  vmstats.vs_zero_fills++;
+
+  splx(spl);
+  return paddr;
+}
+
+static
+void
+free_upage(paddr_t paddr, struct addrspace *as)
+{
+  u_int32_t index = PADDR_TO_COREMAP_INDEX(paddr);
+
+  assert(index < total_coremap_entries);
+  assert(coremap[index].is_allocated && coremap[index].chunk_size == 1);
+  assert(coremap[index].refcount > 0);
+
+  coremap[index].refcount--;
+
+  if (coremap[index].refcount == 0) {
+    if (coremap[index].swap_slot >= 0) {
+      swap_free(coremap[index].swap_slot);
+    }
+    free_kpages(PADDR_TO_KVADDR(paddr));
+  }
+
+  //If the recorded owner lets go of a frame that is still shared we no longer
+  //know which page table the remaining mapping lives in. Orphaned frames are
+  //never evicted; the next copy-on-write break adopts them.
+
+  else if (coremap[index].as == as) {
+    coremap[index].as = NULL;
+  }
+}
+
+static
+void
+page_pin(paddr_t paddr)
+{
+  coremap[PADDR_TO_COREMAP_INDEX(paddr)].pinned++;
+}
+
+static
+void
+page_unpin(paddr_t paddr)
+{
+  u_int32_t index = PADDR_TO_COREMAP_INDEX(paddr);
+
+  assert(coremap[index].pinned > 0);
+  coremap[index].pinned--;
+}
+
+//Clear a frame a word at a time, eight words per iteration. Frames are page
+//aligned, so there are no odd bytes at either end.
+
+static
+void
+page_zero(paddr_t paddr)
+{
+  u_int32_t *p = (u_int32_t *)PADDR_TO_KVADDR(paddr);
+  u_int32_t *end = p + PAGE_SIZE / sizeof(u_int32_t);
+
+  while (p < end) {
+    p[0] = 0; p[1] = 0; p[2] = 0; p[3] = 0;
+    p[4] = 0; p[5] = 0; p[6] = 0; p[7] = 0;
+    p += 8;
+  }
+}
+
+//Hand the pre-zeroed pool back to the allocator. Returns the number of frames
+//freed.
+
+static
+u_int32_t
+zero_pool_drain(void)
+{
+  u_int32_t n = zero_pool_count;
+  int spl = splhigh();
+
+  while (zero_pool_count > 0) {
+    free_kpages(PADDR_TO_KVADDR(zero_pool[--zero_pool_count]));
+  }
+
+  splx(spl);
+  return n;
+}
+
+/*Called by the scheduler while no thread is runnable, with interrupts off.
+  Zeroes one frame into the pool and returns nonzero, or returns 0 if there is
+  nothing to do and the CPU may as well halt. Only frames the allocator can
+  spare are taken, and never through getppages(): the idle loop must not
+  sleep or start evicting.*/
+
+int
+vm_idle(void)
+{
+  int index;
+
+  assert(curspl > 0);
+
+  if (!booted || zero_paddr == 0 || zero_pool_count == ZERO_POOL_SIZE ||
+      num_free_coremap_entries <= pageout_high + ZERO_POOL_SIZE) {
+    return 0;
+  }
+
+  index = buddy_alloc(1);
+  if (index < 0) {
+    return 0;
+  }
+
+  num_free_coremap_entries--;
+  coremap[index].is_allocated = 1;
+  coremap[index].chunk_size = 1;
+  coremap[index].as = NULL;
+
+  page_zero(coremap[index].page_frame);
+  zero_pool[zero_pool_count++] = coremap[index].page_frame;
+
+  return 1;
+}
 
 /**************************ADDRESS SPACE FUNCTIONS*****************************/
 
+//Allocate a region record. A file region takes its own open reference on the
+//vnode, the same way as_copy() does for the executable.
+
+static
+struct vm_region *
+region_create(vaddr_t base, size_t npages, unsigned int permissions,
+              struct vnode *v, off_t offset)
+{
+  struct vm_region *vr = kmalloc(sizeof(struct vm_region));
+  if (vr == NULL) {
+    return NULL;
+  }
+
+  vr->vr_base = base;
+  vr->vr_npages = npages;
+  vr->vr_permissions = permissions;
+  vr->vr_vnode = v;
+  vr->vr_offset = offset;
+  vr->vr_next = NULL;
+
+  if (v != NULL) {
+    VOP_INCOPEN(v);
+    VOP_INCREF(v);
+  }
+
+  return vr;
+}
+
+static
+void
+region_destroy(struct vm_region *vr)
+{
+  if (vr->vr_vnode != NULL) {
+    vfs_close(vr->vr_vnode);
+  }
+  kfree(vr);
+}
+
 struct addrspace *
 as_create(void)
 {
@@ -295,10 +690,27 @@ as_create(void)
     (as->as_v).filesize[i] = 0;
   }
 
+  for (i = 0; i < NUM_STATIC_SEGMENTS; i++) {
+    as->as_ra_next[i] = 0;
+    as->as_ra_window[i] = 0;
+  }
+
 	as->as_brk = (vaddr_t)0;
-  as->as_stackptr = (vaddr_t)0;
+  as->as_stackptr = USERSTACK;
+  as->as_stacklimit = USERSTACK_LIMIT;
+  as->as_heaplimit = USERHEAP_LIMIT;
   as->heap_max = (vaddr_t)0;
 
+  as->as_resident = 0;
+  as->as_swapped = 0;
+  as->as_shared = 0;
+
+  as->as_regions = NULL;
+
+  //No ASID until first activated.
+  as->as_asid = 0;
+  as->as_asid_generation = 0;
+
 	return as;
 }
 
@@ -310,21 +722,15 @@ as_destroy(struct addrspace *as)
   int spl = splhigh();
   unsigned int i;
 
-  /*Free up any frames associated with this address space.*/
-  for (i = 0; i < total_coremap_entries; i++) {
-
-    if (coremap[i].as == as) {
-      coremap[i].is_allocated = 0;
-      coremap[i].chunk_size = 0;
+  //Nothing will run with this ASID again; free up the slots its entries hold.
 
-      if (booted) {
-        coremap[i].as = NULL;
-      }
-    }
-  }
+  tlb_unmap_range(as, 0, USERTOP / PAGE_SIZE);
 
-  /*Walk through the page table starting from level 2 destoying relevant page
-    table arrays.*/
+  /*Walk through the page table starting from level 2, releasing the frame
+    (or swap slot) behind every valid PTE and then the page table pages
+    themselves. Only the second level tables that were actually created are
+    visited, so the cost follows the size of the process rather than the size
+    of physical memory.*/
 
   for (i = 0; i < NUMBER_OF_PAGE_TABLE_ENTRIES; i++) {
 
@@ -335,66 +741,158 @@ as_destroy(struct addrspace *as)
       unsigned int j;
       for (j = 0; j < NUMBER_OF_PAGE_TABLE_ENTRIES; j++) {
 
-        struct page_table_entry * PTE = as->master_page_table[i]->second_level_page_table[j];
+        page_table_entry PTE = master->second_level_page_table[j];
 
-        if (PTE != NULL) {
-          kfree(PTE);
+        if (PTE & PTE_VALID) {
+          if (PTE & PTE_SWAPPED) {
+            swap_free(PTE_SLOT(PTE));
+          }
+          else {
+            free_upage(PTE_PADDR(PTE), as);
+          }
         }
       }
 
-      kfree(master);
+      free_kpages((vaddr_t)master);
     }
   }
 
+  struct vm_region *regions = as->as_regions;
+
   kfree(as);
   splx(spl);
+
+  //Closing a mapped file may sleep, so do it last.
+
+  while (regions != NULL) {
+    struct vm_region *next = regions->vr_next;
+    region_destroy(regions);
+    regions = next;
+  }
 }
 
+//Give as the next free ASID, starting a new generation (and flushing the TLB)
+//if they have run out.
+
+static
 void
-as_activate(struct addrspace *as)
+asid_assign(struct addrspace *as)
 {
-  int i;
-
-	(void)as;
+  assert(curspl > 0); //Interrupts should be off
 
-  //flush the TLB after the context switch
+  if (asid_next == NUM_TLB_PIDS) {
 
-	int spl = splhigh();
+    //Through tlb.c, so the clock's reference and pin bits are cleared too.
+    tlb_flush_all();
 
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
+    asid_generation++;
+    asid_next = 1;
+  }
 
-	splx(spl);
+  as->as_asid = asid_next++;
+  as->as_asid_generation = asid_generation;
 }
 
-/*
- * Set up a segment at virtual address VADDR of size MEMSIZE. The
- * segment in memory extends from VADDR up to (but not including)
- * VADDR+MEMSIZE.
- *
- * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
- */
-int
-as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
-		 int readable, int writeable, int executable, size_t ph_index)
+//Entryhi value for vaddr in as. Only meaningful while as has a current ASID.
+
+static
+u_int32_t
+as_tlbhi(struct addrspace *as, vaddr_t vaddr)
 {
-  size_t npages;
+  return (vaddr & TLBHI_VPAGE) | (as->as_asid << TLBHI_PIDSHIFT);
+}
 
-	/* Align the region. First, the base... */
-	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
-	vaddr &= PAGE_FRAME;
+//Whether the TLB entry for vaddr should be pinned under the clock policy:
+//text and stack pages are touched on nearly every instruction of a loop.
 
-  assert((vaddr & PAGE_FRAME) == vaddr);
+static
+int
+as_tlbpin(struct addrspace *as, vaddr_t vaddr)
+{
+  vaddr_t text = (as->memory_segments[TEXT]).v_base;
 
-	/* ...and now the length. */
-	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
-  assert(sz % PAGE_SIZE == 0);
+  if (vaddr >= text && vaddr < text + (as->memory_segments[TEXT]).npages * PAGE_SIZE) {
+    return 1;
+  }
+  return (vaddr >= as->as_stackptr && vaddr < USERSTACK);
+}
 
-	npages = sz / PAGE_SIZE;
+//Clear the write-enable bit on every TLB entry belonging to as.
+
+static
+void
+tlb_write_protect(struct addrspace *as)
+{
+  u_int32_t ehi, elo;
+  int i;
+
+  int spl = splhigh();
+
+  if (as->as_asid_generation == asid_generation) {
+    for (i=0; i<NUM_TLB; i++) {
+      TLB_Read(&ehi, &elo, i);
+      if ((elo & TLBLO_VALID) && (elo & TLBLO_DIRTY) &&
+          (ehi & TLBHI_PID) == (as->as_asid << TLBHI_PIDSHIFT)) {
+        TLB_Write(ehi, elo & ~TLBLO_DIRTY, i);
+      }
+    }
+  }
+
+  splx(spl);
+}
+
+/*Translations are tagged with the address space's ASID, so nothing needs to be
+  flushed on a context switch: just switch the PID the TLB matches against. An
+  address space whose ASID belongs to an old generation gets a new one; its
+  stale entries were flushed when the generation rolled over.*/
+
+void
+as_activate(struct addrspace *as)
+{
+	int spl = splhigh();
+
+  if (as == NULL) {
+    TLB_SetPID(0);
+    splx(spl);
+    return;
+  }
+
+  if (as->as_asid_generation != asid_generation) {
+    asid_assign(as);
+  }
+
+  TLB_SetPID(as->as_asid);
+
+	splx(spl);
+}
+
+/*
+ * Set up a segment at virtual address VADDR of size MEMSIZE. The
+ * segment in memory extends from VADDR up to (but not including)
+ * VADDR+MEMSIZE.
+ *
+ * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
+ * write, or execute permission should be set on the segment. At the
+ * moment, these are ignored. When you write the VM system, you may
+ * want to implement them.
+ */
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable, size_t ph_index)
+{
+  size_t npages;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+  assert((vaddr & PAGE_FRAME) == vaddr);
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+  assert(sz % PAGE_SIZE == 0);
+
+	npages = sz / PAGE_SIZE;
 
   //define a new memory segment. For some reason ph_index starts with 1.
 
@@ -405,6 +903,13 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	return 0;
 }
 
+/*
+ * Fork the address space copy-on-write. No frames are allocated or copied
+ * here: the child gets its own page table whose PTEs point at the parent's
+ * frames, both sides are marked COW and each frame's reference count goes
+ * up. The first write from either side then takes a VM_FAULT_READONLY (or a
+ * write miss) and gets a private copy in TLB_page_fault_handler().
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -425,252 +930,1439 @@ as_copy(struct addrspace *old, struct addrspace **ret)
   new->as_brk = old->as_brk;
   new->heap_max = old->heap_max;
   new->as_stackptr = old->as_stackptr;
+  new->as_stacklimit = old->as_stacklimit;
+  new->as_heaplimit = old->as_heaplimit;
+
+  //Now copy the segments info.
+
+  unsigned int i;
+
+  for (i = 0; i < NUM_SEGMENTS; i++){
+      new->memory_segments[i].v_base = old->memory_segments[i].v_base;
+      new->memory_segments[i].npages = old->memory_segments[i].npages;
+      new->memory_segments[i].permissions = old->memory_segments[i].permissions;
+  }
+
+  //mmap()ed regions. Their pages are shared along with everything else below.
+
+  struct vm_region *vr;
+
+  for (vr = old->as_regions; vr != NULL; vr = vr->vr_next) {
+    struct vm_region *copy = region_create(vr->vr_base, vr->vr_npages,
+        vr->vr_permissions, vr->vr_vnode, vr->vr_offset);
+    if (copy == NULL) {
+      splx(spl);
+      as_destroy(new);
+      return ENOMEM;
+    }
+    copy->vr_next = new->as_regions;
+    new->as_regions = copy;
+  }
+
+  //Page table next. Share every mapped frame with the child.
+
+  for(i = 0; i < NUMBER_OF_PAGE_TABLE_ENTRIES; i++){
+
+    if (old->master_page_table[i] == NULL){
+      continue;
+    }
+
+    new->master_page_table[i] = page_table_L2_create();
+    if (new->master_page_table[i] == NULL) {
+      as_destroy(new);
+      splx(spl);
+      return ENOMEM;
+    }
+
+    int j;
+    for (j = 0; j < NUMBER_OF_PAGE_TABLE_ENTRIES; j++){
+
+      page_table_entry *old_PTE = &old->master_page_table[i]->second_level_page_table[j];
+
+      if (!(*old_PTE & PTE_VALID)){
+        continue;
+      }
+
+      //Swap slots aren't shared, so bring swapped pages back in before
+      //handing out a second reference to them.
+
+      if (*old_PTE & PTE_SWAPPED) {
+        int result = page_in(old, old_PTE, (i << 22) | (j << 12));
+        if (result) {
+          as_destroy(new);
+          splx(spl);
+          return result;
+        }
+      }
+
+      pte_set(old, old_PTE, *old_PTE | PTE_COW);
+      pte_set(new, &new->master_page_table[i]->second_level_page_table[j], *old_PTE);
+      coremap[PADDR_TO_COREMAP_INDEX(PTE_PADDR(*old_PTE))].refcount++;
+    }
+  }
+
+  for (i = 0; i < NUM_STATIC_SEGMENTS; i++) {
+    (new->as_v).filesize[i] = (old->as_v).filesize[i];
+    (new->as_v).offset[i] = (old->as_v).offset[i];
+  }
+
+  //The child shares the executable's vnode so it can keep loading text and
+  //data on demand. thread_exit() closes it again.
+
+  (new->as_v).as_vnode = (old->as_v).as_vnode;
+  VOP_INCOPEN((old->as_v).as_vnode);
+  VOP_INCREF((old->as_v).as_vnode);
+
+  //The parent's TLB may still hold writable translations for pages that are
+  //now copy-on-write. Take away write permission so its next write faults.
+
+  tlb_write_protect(old);
+
+  *ret = new;
+
+  splx(spl);
+	return 0;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+  //Setup heap
+  (as->memory_segments[HEAP]).v_base = (as->memory_segments[DATA]).v_base + (as->memory_segments[DATA]).npages*PAGE_SIZE; //end of data = heap.
+  (as->memory_segments[HEAP]).npages = (size_t)0;
+  (as->memory_segments[HEAP]).permissions = PF_R | PF_W;
+  as->as_brk = (as->memory_segments[HEAP]).v_base; //initial break value is the base
+
+  //Setup stack. It starts out empty and grows down from USERSTACK as it is
+  //touched; see as_grow_stack().
+  (as->memory_segments[STACK]).v_base = USERSTACK;
+  (as->memory_segments[STACK]).npages = 0;
+  (as->memory_segments[STACK]).permissions = PF_R | PF_W;
+  as->as_stackptr = USERSTACK; //initially stack points at the top of user VAs
+
+  //The heap may grow up to the guard pages below the stack.
+  as_update_heap_max(as);
+
+  return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+  //assert(); //assume the heap and stack don't overlap
+  (void)as;
+	return 0;
+}
+
+/*Extend the stack down to cover the page at vaddr. The heap and the stack grow
+  toward each other: the stack may not come within STACK_GUARD_PAGES of the
+  break, so running into the heap (or the guard pages) is a segmentation fault
+  rather than silent corruption, and sbrk() in turn stops at the guard pages
+  below the stack. The stack is also capped at as_stacklimit bytes.*/
+
+static
+int
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+  vaddr_t bottom = vaddr & PAGE_FRAME;
+
+  assert(bottom < as->as_stackptr);
+
+  if (USERSTACK - bottom > as->as_stacklimit) {
+    return EFAULT;
+  }
+
+  if (bottom < ROUNDUP(as->as_brk, PAGE_SIZE) + STACK_GUARD_PAGES * PAGE_SIZE) {
+    return EFAULT;
+  }
+
+  as->as_stackptr = bottom;
+  (as->memory_segments[STACK]).npages = (USERSTACK - bottom) / PAGE_SIZE;
+  as_update_heap_max(as);
+
+  return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	(void)as;
+	/* Initial user-level stack pointer */
+	*stackptr = USERSTACK;
+	return 0;
+}
+
+/*Change how far the stack may grow. The limit can't drop below what the stack
+  already uses, and raising it must leave a guard gap above the break and every
+  mmap()ed region, since those are placed below the stack's reservation.*/
+
+int
+as_setstacklimit(struct addrspace *as, size_t limit)
+{
+  struct vm_region *vr;
+  vaddr_t bottom;
+  int spl;
+
+  if (limit > USERSTACK) {
+    return EINVAL;
+  }
+  limit = ROUNDUP(limit, PAGE_SIZE);
+
+  spl = splhigh();
+
+  if (limit < USERSTACK - as->as_stackptr) {
+    splx(spl);
+    return EINVAL;
+  }
+
+  if (limit / PAGE_SIZE + STACK_GUARD_PAGES > USERSTACK / PAGE_SIZE) {
+    splx(spl);
+    return ENOMEM;
+  }
+  bottom = USERSTACK - limit - STACK_GUARD_PAGES * PAGE_SIZE;
+
+  if (bottom < ROUNDUP(as->as_brk, PAGE_SIZE)) {
+    splx(spl);
+    return ENOMEM;
+  }
+  for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+    if (vr->vr_base + vr->vr_npages * PAGE_SIZE > bottom) {
+      splx(spl);
+      return ENOMEM;
+    }
+  }
+
+  as->as_stacklimit = limit;
+
+  splx(spl);
+  return 0;
+}
+
+/*Change how far the heap may grow. Like the stack, it can't be set below what
+  the heap already uses. The guard gap under the stack and mmap()ed regions
+  still applies whatever the limit.*/
+
+int
+as_setheaplimit(struct addrspace *as, size_t limit)
+{
+  vaddr_t heapbase = (as->memory_segments[HEAP]).v_base;
+  int spl;
+
+  if (limit > USERTOP) {
+    return EINVAL;
+  }
+
+  spl = splhigh();
+
+  if (limit < as->as_brk - heapbase) {
+    splx(spl);
+    return EINVAL;
+  }
+
+  as->as_heaplimit = limit;
+
+  splx(spl);
+  return 0;
+}
+
+/**********************************MMAP****************************************/
+
+/*mmap()ed regions live between the heap and the stack. They are placed top
+  down, starting a guard gap below the furthest the stack may grow, and the
+  heap stops a guard gap below the lowest of them, the same way it stops below
+  the stack.*/
+
+static
+struct vm_region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+  struct vm_region *vr;
+
+  for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+    if (vaddr >= vr->vr_base && vaddr < vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+      return vr;
+    }
+  }
+  return NULL;
+}
+
+static
+void
+as_update_heap_max(struct addrspace *as)
+{
+  struct vm_region *vr;
+  vaddr_t limit = as->as_stackptr;
+
+  for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+    if (vr->vr_base < limit) {
+      limit = vr->vr_base;
+    }
+  }
+
+  as->heap_max = limit - STACK_GUARD_PAGES * PAGE_SIZE;
+}
+
+/*Map npages pages of anonymous memory (v == NULL) or of the file v starting
+  at offset, which must be page aligned. Nothing is read here; pages come in
+  on first touch. The mapping is private: writes go to the process's own copy
+  and never back to the file. Returns the address chosen in *addr.*/
+
+int
+as_mmap(struct addrspace *as, size_t len, unsigned int permissions,
+        struct vnode *v, off_t offset, vaddr_t *addr)
+{
+  struct vm_region *vr;
+  vaddr_t top, base, floor;
+  size_t npages;
+
+  //Bound len before rounding it up, which would wrap to 0 near 4GB.
+  if (len == 0 || len > USERTOP || (offset & ~PAGE_FRAME) != 0) {
+    return EINVAL;
+  }
+
+  //Let the file system refuse things that can't be paged in with VOP_READ.
+  if (v != NULL) {
+    int result = VOP_MMAP(v);
+    if (result) {
+      return result;
+    }
+  }
+
+  npages = DIVROUNDUP(len, PAGE_SIZE);
+
+  vr = region_create(0, npages, permissions, v, offset);
+  if (vr == NULL) {
+    return ENOMEM;
+  }
+
+  int spl = splhigh();
+
+  //Highest gap that fits, scanning down from the top of the mmap area.
+
+  //Compare sizes in pages so none of this can wrap.
+
+  if (ROUNDUP(as->as_stacklimit, PAGE_SIZE) / PAGE_SIZE + STACK_GUARD_PAGES >
+      USERSTACK / PAGE_SIZE) {
+    splx(spl);
+    region_destroy(vr);
+    return ENOMEM;
+  }
+
+  top = USERSTACK - ROUNDUP(as->as_stacklimit, PAGE_SIZE) - STACK_GUARD_PAGES * PAGE_SIZE;
+  floor = ROUNDUP(as->as_brk, PAGE_SIZE) + STACK_GUARD_PAGES * PAGE_SIZE;
+
+  while (1) {
+    struct vm_region *other;
+
+    if (top < floor || (top - floor) / PAGE_SIZE < npages) {
+      splx(spl);
+      region_destroy(vr);
+      return ENOMEM;
+    }
+
+    base = top - npages * PAGE_SIZE;
+
+    for (other = as->as_regions; other != NULL; other = other->vr_next) {
+      if (base < other->vr_base + other->vr_npages * PAGE_SIZE &&
+          other->vr_base < top) {
+        break;
+      }
+    }
+
+    if (other == NULL) {
+      break;
+    }
+    top = other->vr_base;
+  }
+
+  vr->vr_base = base;
+  vr->vr_next = as->as_regions;
+  as->as_regions = vr;
+
+  as_update_heap_max(as);
+
+  splx(spl);
+
+  *addr = base;
+  return 0;
+}
+
+/*Remove [addr, addr + len) from whatever regions it overlaps, freeing the
+  pages. A region that loses its middle is split in two.*/
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+  struct vm_region **pp, *vr, *tail, *dead = NULL;
+  vaddr_t start, end, vr_end;
+
+  if ((addr & ~PAGE_FRAME) != 0 || len == 0) {
+    return EINVAL;
+  }
+
+  start = addr;
+  end = addr + ROUNDUP(len, PAGE_SIZE);
+  if (end < start) {
+    return EINVAL;
+  }
+
+  //Splitting needs a new record; get it before touching anything.
+
+  tail = kmalloc(sizeof(struct vm_region));
+  if (tail == NULL) {
+    return ENOMEM;
+  }
+
+  int spl = splhigh();
+
+  pp = &as->as_regions;
+  while ((vr = *pp) != NULL) {
+
+    vr_end = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+
+    if (end <= vr->vr_base || start >= vr_end) {
+      pp = &vr->vr_next;
+      continue;
+    }
+
+    as_unmap(as, start > vr->vr_base ? start : vr->vr_base,
+             end < vr_end ? end : vr_end);
+
+    if (start <= vr->vr_base && end >= vr_end) {
+      //All of it.
+      *pp = vr->vr_next;
+      vr->vr_next = dead;
+      dead = vr;
+      continue;
+    }
+
+    if (start > vr->vr_base && end < vr_end) {
+      //A hole in the middle: the part above it becomes a new region.
+      *tail = *vr;
+      tail->vr_base = end;
+      tail->vr_npages = (vr_end - end) / PAGE_SIZE;
+      tail->vr_offset = vr->vr_offset + (end - vr->vr_base);
+      if (tail->vr_vnode != NULL) {
+        VOP_INCOPEN(tail->vr_vnode);
+        VOP_INCREF(tail->vr_vnode);
+      }
+      vr->vr_npages = (start - vr->vr_base) / PAGE_SIZE;
+      vr->vr_next = tail;
+      tail = NULL;
+      break;
+    }
+
+    if (start <= vr->vr_base) {
+      //The bottom.
+      vr->vr_offset += end - vr->vr_base;
+      vr->vr_npages = (vr_end - end) / PAGE_SIZE;
+      vr->vr_base = end;
+    }
+    else {
+      //The top.
+      vr->vr_npages = (start - vr->vr_base) / PAGE_SIZE;
+    }
+    pp = &vr->vr_next;
+  }
+
+  as_update_heap_max(as);
+
+  splx(spl);
+
+  if (tail != NULL) {
+    kfree(tail);
+  }
+
+  while (dead != NULL) {
+    vr = dead->vr_next;
+    region_destroy(dead);
+    dead = vr;
+  }
+
+  return 0;
+}
+
+//Read the page at vaddr of a file region into the (pinned, not yet visible)
+//frame at paddr. Whatever lies past the end of the file reads as zeros.
+
+static
+int
+region_fill(struct vm_region *vr, vaddr_t vaddr, paddr_t paddr)
+{
+  struct uio ku;
+  int result;
+
+  mk_kuio(&ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+          vr->vr_offset + (vaddr - vr->vr_base), UIO_READ);
+
+  result = VOP_READ(vr->vr_vnode, &ku);
+  if (result) {
+    return result;
+  }
+
+  if (ku.uio_resid > 0) {
+    bzero((char *)PADDR_TO_KVADDR(paddr) + PAGE_SIZE - ku.uio_resid, ku.uio_resid);
+  }
+
+  vmstats.vs_mmap_reads++;
+
+  return 0;
+}
+
+/*****************************PAGE TABLE FUNCTIONS*****************************/
+
+/*Intended to be bitwise ANDED with the fault address in question to retain the
+  first 10 bits.*/
+#define FIRST_LEVEL_PAGE_TABLE_INDEX_MASK 0xFFC00000
+
+/*Intended to be bitwise ANDED with the fault address in question to retain the
+  mid 10 bits.*/
+#define SECOND_LEVEL_PAGE_TABLE_INDEX_MASK 0x003FF000
+
+//similarly get the offset
+
+#define OFFSET_MASK 0x00000FFF
+
+#define VPN_BITS 22
+#define OFFSET_BITS 12
+
+//helper function to initialize the 2nd level of the page table. It is exactly
+//one page, so take it straight from the coremap and skip kmalloc.
+
+static
+struct page_table_entry_array*
+page_table_L2_create(void){
+
+  assert(sizeof(struct page_table_entry_array) == PAGE_SIZE);
+
+  struct page_table_entry_array *level2_pagetable = (struct page_table_entry_array *)alloc_kpages(1);
+  if (level2_pagetable == NULL){
+    return NULL;
+  }
+
+  //All zero means no valid entries.
+  page_zero(KVADDR_TO_PADDR((vaddr_t)level2_pagetable));
+
+  return (level2_pagetable);
+}
+
+//Add delta to the page count of as that pte falls under, if any.
+
+static
+void
+pte_count(struct addrspace *as, page_table_entry pte, int delta)
+{
+  if (!(pte & PTE_VALID)) {
+    return;
+  }
+
+  if (pte & PTE_SWAPPED) {
+    as->as_swapped += delta;
+    return;
+  }
+
+  as->as_resident += delta;
+  if (pte & PTE_COW) {
+    as->as_shared += delta;
+  }
+}
+
+//Store a new value in one of as's PTEs. Every change that makes a page valid
+//or invalid, resident or swapped, or copy-on-write or private goes through
+//here, so as's page counts stay in step. Setting the dirty and referenced
+//bits doesn't need to.
+
+static
+void
+pte_set(struct addrspace *as, page_table_entry *PTE, page_table_entry pte)
+{
+  pte_count(as, *PTE, -1);
+  pte_count(as, pte, 1);
+  *PTE = pte;
+}
+
+//helper fn to fill in a PTE with a fresh frame, zeroed if ZEROED is set.
+//Nothing is on disk yet, so the page starts out dirty. The new frame is left
+//pinned until the fault handler has finished loading it.
+
+static
+int
+create_PTE(page_table_entry *PTE, int permissions, vaddr_t vaddr, int zeroed) {
+
+  assert(curspl > 0); //Interrupts should still be off
+  assert(!(*PTE & PTE_VALID));
+
+  //Allocate a page for the segment on demand
+
+  paddr_t paddr = zeroed ? alloc_upage_zeroed(curthread->t_vmspace, vaddr) :
+                           alloc_upage(curthread->t_vmspace, vaddr);
+  if (paddr == 0) {
+    return ENOMEM;
+  }
+
+  pte_set(curthread->t_vmspace, PTE, paddr | PTE_VALID | PTE_DIRTY |
+          ((permissions << PTE_PERM_SHIFT) & PTE_PERM_MASK));
+
+  return 0;
+}
+
+//Function to find a PTE given a VPN (already divided into the higher and lower
+//bits). We return a pointer to the page table entry, or NULL if it isn't
+//valid.
+
+static
+page_table_entry*
+find_page_table_entry (struct addrspace *as, u_int32_t idx_L1, u_int32_t idx_L2, unsigned int operation_type, int *err)
+{
+    //Strategy: use the master & secondary page numbers. This allows
+    //you to access the various levels of the cache. Then check the permissions
+    //flag. Are we allowed to perform the operation? If yes, then return the found
+    //PTE. If there is no existing such PTE, return NULL.
+
+    page_table_entry* searched = NULL;
+
+    assert(as != NULL);
+    assert(as->master_page_table[idx_L1] != NULL); //at least the 1st level must be pointing
+                                                  //to a valid substructure in L2.
+
+    searched = &(as->master_page_table[idx_L1])->second_level_page_table[idx_L2];
+
+    if (!(*searched & PTE_VALID)) {
+      searched = NULL;
+    }
+
+    // if(searched != NULL){
+    //   if (operation_type != PTE_PERMISSIONS(*searched)){
+    //     *err = EFAULT; //an invalid operation
+    //   }
+    // }
+
+    // if (searched == NULL) {
+    //   *err = EFAULT;
+    // }
+    return (searched);
+}
+
+/*Throw away every page in [start, end), both page aligned: free the frame or
+  swap slot behind each mapped page, drop it from the TLB and clear its PTE.
+  Untouched pages cost nothing, and whole missing second level tables are
+  skipped.*/
+
+void
+as_unmap(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+  struct page_table_entry_array *level_2_page_table;
+  page_table_entry *PTE;
+  vaddr_t vaddr;
+
+  assert((start & PAGE_FRAME) == start);
+  assert((end & PAGE_FRAME) == end);
+
+  int spl = splhigh();
+
+  //Drop the whole range from the TLB first; the frames go below.
+
+  tlb_unmap_range(as, start, (end - start) / PAGE_SIZE);
+
+  for (vaddr = start; vaddr < end && vaddr >= start; vaddr += PAGE_SIZE) {
+
+    level_2_page_table = as->master_page_table[(vaddr & FIRST_LEVEL_PAGE_TABLE_INDEX_MASK) >> VPN_BITS];
+    if (level_2_page_table == NULL) {
+      //Skip to the last page this table would have covered.
+      vaddr |= ~FIRST_LEVEL_PAGE_TABLE_INDEX_MASK & PAGE_FRAME;
+      continue;
+    }
+
+    PTE = &level_2_page_table->second_level_page_table[(vaddr & SECOND_LEVEL_PAGE_TABLE_INDEX_MASK) >> OFFSET_BITS];
+    if (!(*PTE & PTE_VALID)) {
+      continue;
+    }
+
+    if (*PTE & PTE_SWAPPED) {
+      swap_free(PTE_SLOT(*PTE));
+    }
+    else {
+      free_upage(PTE_PADDR(*PTE), as);
+    }
+
+    pte_set(as, PTE, 0);
+  }
+
+  splx(spl);
+}
+
+/******************************PAGING******************************************/
+
+//Drop the TLB entry for vaddr in as, if any. Translations for every address
+//space that has run in this ASID generation may be in the TLB, not just the
+//current one's, so go by the owner's ASID. If as has none in this generation
+//its entries were flushed at the rollover.
+
+static
+void
+tlb_unmap(struct addrspace *as, vaddr_t vaddr)
+{
+  int spl = splhigh();
+
+  if (as->as_asid_generation == asid_generation) {
+    tlb_invalidate_page(as_tlbhi(as, vaddr));
+  }
+
+  splx(spl);
+}
+
+//Same for npages pages from vaddr, in one batch. Everything else in the TLB
+//stays loaded.
+
+static
+void
+tlb_unmap_range(struct addrspace *as, vaddr_t vaddr, u_int32_t npages)
+{
+  int spl = splhigh();
+
+  if (as->as_asid_generation == asid_generation) {
+    tlb_invalidate_range(as_tlbhi(as, vaddr), npages);
+  }
+
+  splx(spl);
+}
+
+//A frame can be paged out if it backs exactly one user page whose owner we
+//know and nobody is working on it.
+
+static
+int
+page_evictable(u_int32_t index)
+{
+  return coremap[index].is_allocated &&
+         coremap[index].chunk_size == 1 &&
+         coremap[index].as != NULL &&
+         coremap[index].refcount == 1 &&
+         coremap[index].pinned == 0;
+}
+
+//Find the PTE mapping an evictable frame, through the coremap's reverse
+//mapping.
+
+static
+page_table_entry*
+page_owner_PTE(u_int32_t index)
+{
+  vaddr_t vaddr = coremap[index].vaddr;
+
+  page_table_entry *PTE = find_page_table_entry(coremap[index].as,
+      (vaddr & FIRST_LEVEL_PAGE_TABLE_INDEX_MASK) >> VPN_BITS,
+      (vaddr & SECOND_LEVEL_PAGE_TABLE_INDEX_MASK) >> OFFSET_BITS, 0, NULL);
+
+  assert(PTE != NULL && !(*PTE & PTE_SWAPPED));
+  assert(PTE_PADDR(*PTE) == coremap[index].page_frame);
+
+  return PTE;
+}
+
+static
+int
+page_dirty(u_int32_t index)
+{
+  return (*page_owner_PTE(index) & PTE_DIRTY) != 0;
+}
+
+/*Second-chance clock over the coremap. Advance the hand to the next evictable
+  frame that hasn't been referenced since the hand last passed. Referenced
+  frames get their bit cleared and their TLB entry dropped on the way, so the
+  next access faults and sets the bit again. Returns -1 if two full sweeps
+  turn up nothing.*/
+
+static
+int
+clock_next_victim(void)
+{
+  u_int32_t scanned, index;
+
+  for (scanned = 0; scanned < 2 * total_coremap_entries; scanned++) {
+
+    index = clock_hand;
+    clock_hand = (clock_hand + 1) % total_coremap_entries;
+
+    if (!page_evictable(index)) {
+      continue;
+    }
+
+    page_table_entry *PTE = page_owner_PTE(index);
+
+    if (*PTE & PTE_REFERENCED) {
+      *PTE &= ~PTE_REFERENCED;
+      tlb_unmap(coremap[index].as, coremap[index].vaddr);
+      continue;
+    }
+
+    return index;
+  }
+
+  return -1;
+}
+
+/*Free a clean frame. Its contents are already in its swap slot, so no I/O is
+  needed: the PTE just takes the slot over.*/
+
+static
+void
+page_reclaim(u_int32_t index)
+{
+  assert(page_evictable(index));
+  assert(!page_dirty(index) && coremap[index].swap_slot >= 0);
+
+  page_table_entry *PTE = page_owner_PTE(index);
+
+  //Only the permissions carry over. A COW page whose other sharers have all
+  //gone is private by now; it comes back from swap in a frame of its own.
+
+  pte_set(coremap[index].as, PTE,
+          ((u_int32_t)coremap[index].swap_slot << 12) | PTE_VALID | PTE_SWAPPED |
+          (*PTE & PTE_PERM_MASK));
+  tlb_unmap(coremap[index].as, coremap[index].vaddr);
+
+  coremap[index].swap_slot = -1;
+  free_kpages(PADDR_TO_KVADDR(coremap[index].page_frame));
+}
+
+/*Write a dirty frame out to its swap slot, allocating one first if it has
+  none. The dirty bit is cleared and the TLB entry dropped before the write
+  starts, so a store that lands while we sleep faults and marks the page dirty
+  again. An extra reference keeps the frame around in case the owner exits in
+  the meantime. May sleep.*/
+
+static
+int
+page_clean(u_int32_t index)
+{
+  paddr_t paddr = coremap[index].page_frame;
+  u_int32_t slot;
+  int result;
+
+  assert(curspl > 0); //Interrupts should still be off
+  assert(page_dirty(index));
+
+  if (coremap[index].swap_slot < 0) {
+    result = swap_alloc(&slot);
+    if (result) {
+      return result;
+    }
+    coremap[index].swap_slot = slot;
+  }
+
+  slot = coremap[index].swap_slot;
+
+  coremap[index].refcount++;
+  *page_owner_PTE(index) &= ~PTE_DIRTY;
+  tlb_unmap(coremap[index].as, coremap[index].vaddr);
+
+  result = swap_out(paddr, slot);
+  if (result == 0) {
+    vmstats.vs_swap_outs++;
+  }
+
+  //On failure the swap copy is no good; mark the page dirty again, unless the
+  //owner let go of the frame while we slept and it is about to be freed.
+
+  if (result && coremap[index].as != NULL) {
+    *page_owner_PTE(index) |= PTE_DIRTY;
+  }
+
+  free_upage(paddr, NULL);
+
+  return result;
+}
+
+/*Synchronous eviction, for a thread that found no free frame at all. Normally
+  the pageout daemon keeps enough frames free that this isn't needed. Returns
+  0 if it made progress and the allocation is worth retrying.*/
+
+static
+int
+page_evict(void)
+{
+  int index, result;
+
+  assert(curspl > 0); //Interrupts should still be off
+
+  index = clock_next_victim();
+  if (index < 0) {
+    return ENOMEM;
+  }
+
+  if (page_dirty(index)) {
+
+    result = page_clean(index);
+    if (result) {
+      return result;
+    }
+
+    //We slept. The page may have been written to, freed or taken by someone
+    //else meanwhile; let the caller look again.
+
+    if (!page_evictable(index) || page_dirty(index)) {
+      return 0;
+    }
+  }
+
+  page_reclaim(index);
+
+  return 0;
+}
+
+//Bring a swapped out page back into a fresh frame. The swap copy is kept, so
+//the page stays clean and can be dropped again for free until it is written.
+
+static
+int
+page_in(struct addrspace *as, page_table_entry *PTE, vaddr_t vaddr)
+{
+  assert(curspl > 0); //Interrupts should still be off
+  assert(*PTE & PTE_SWAPPED);
+
+  u_int32_t slot = PTE_SLOT(*PTE);
+  int result;
+
+  paddr_t paddr = alloc_upage(as, vaddr);
+  if (paddr == 0) {
+    return ENOMEM;
+  }
+
+  result = swap_in(paddr, slot);
+  if (result) {
+    page_unpin(paddr);
+    free_upage(paddr, as);
+    return result;
+  }
+
+  vmstats.vs_swap_ins++;
+
+  coremap[PADDR_TO_COREMAP_INDEX(paddr)].swap_slot = slot;
+
+  pte_set(as, PTE, paddr | PTE_VALID | (*PTE & PTE_PERM_MASK));
+
+  page_unpin(paddr);
+
+  return 0;
+}
+
+/*****************************PAGEOUT DAEMON***********************************/
+
+/*Kernel thread that keeps a reserve of free frames so that faults rarely have
+  to wait for the disk. getppages() wakes it when the free count drops below
+  pageout_low. Text pages nobody maps any more are dropped from the page cache
+  first. Then it runs the clock: clean, unreferenced frames are freed on the
+  spot and dirty ones are collected and written out PAGEOUT_BATCH at a time,
+  to be freed on a later sweep if nobody touches them. It goes back to sleep
+  at pageout_high, or when a sweep makes no progress.*/
+
+void
+pageout_thread(void *data1, unsigned long data2)
+{
+  int batch[PAGEOUT_BATCH];
+  int nbatch, progress, index, i;
+  u_int32_t scanned;
+
+  (void)data1;
+  (void)data2;
+
+  splhigh();
+
+  while (1) {
+
+    while (num_free_coremap_entries >= pageout_low &&
+           !pcache_release_pending()) {
+      thread_sleep(&pageout_low);
+    }
+
+    do {
+      progress = pcache_reclaim(pageout_high);
+
+      //Cache entries freed here or by getppages() still hold their vnodes.
+      pcache_release();
+
+      nbatch = 0;
+
+      if (!swap_enabled()) {
+        continue;
+      }
+
+      for (scanned = 0; scanned < total_coremap_entries &&
+           num_free_coremap_entries < pageout_high &&
+           nbatch < PAGEOUT_BATCH; scanned++) {
+
+        index = clock_next_victim();
+        if (index < 0) {
+          break;
+        }
+
+        if (page_dirty(index)) {
+          batch[nbatch++] = index;
+        }
+        else {
+          page_reclaim(index);
+          progress++;
+        }
+      }
+
+      //Each write sleeps, so recheck every page before starting on it.
+
+      for (i = 0; i < nbatch; i++) {
+        if (page_evictable(batch[i]) && page_dirty(batch[i]) &&
+            page_clean(batch[i]) == 0) {
+          progress++;
+        }
+      }
+
+    } while (num_free_coremap_entries < pageout_high && progress > 0);
+
+    //Nothing more to free for now; wait for the next allocation.
+
+    if (num_free_coremap_entries < pageout_low && !pcache_release_pending()) {
+      thread_sleep(&pageout_low);
+    }
+  }
+}
+
+//Called whenever frames are taken. Wakes the daemon once free memory runs low.
+
+static
+void
+pageout_poke(void)
+{
+  if (booted && num_free_coremap_entries < pageout_low) {
+    thread_wakeup(&pageout_low);
+  }
+}
+
+//File offset of the text page at vaddr in the current executable.
+
+static
+off_t
+text_offset(struct addrspace *as, vaddr_t vaddr)
+{
+  return (as->as_v).offset[TEXT] + (vaddr - (as->memory_segments[TEXT]).v_base);
+}
+
+//Map a text page straight from the page cache if another process has already
+//loaded it. The frame is shared, so it goes in copy-on-write. Returns 1 if
+//the page was cached.
+
+static
+int
+pcache_map(page_table_entry *PTE, int permissions, vaddr_t vaddr)
+{
+  struct addrspace *as = curthread->t_vmspace;
+  paddr_t paddr;
+
+  assert(!(*PTE & PTE_VALID));
+
+  if ((as->as_v).as_vnode == NULL) {
+    return 0;
+  }
+
+  paddr = pcache_lookup((as->as_v).as_vnode, text_offset(as, vaddr));
+  if (paddr == 0) {
+    return 0;
+  }
+
+  pte_set(as, PTE, paddr | PTE_VALID | PTE_COW |
+          ((permissions << PTE_PERM_SHIFT) & PTE_PERM_MASK));
+
+  return 1;
+}
+
+//Heap, stack and anonymous mmap() pages start out as zeros.
+
+static
+int
+region_zero_filled(u_int32_t region_no)
+{
+  return region_no == HEAP || region_no == STACK || region_no == MMAP_ANON;
+}
+
+//A first read of a heap or stack page maps the shared zero frame; a real
+//frame is only allocated (by break_cow()) when the page is written.
+
+static
+void
+zero_map(page_table_entry *PTE, int permissions)
+{
+  assert(!(*PTE & PTE_VALID));
+
+  coremap[PADDR_TO_COREMAP_INDEX(zero_paddr)].refcount++;
+  vmstats.vs_zero_maps++;
+
+  pte_set(curthread->t_vmspace, PTE, zero_paddr | PTE_VALID | PTE_COW |
+          ((permissions << PTE_PERM_SHIFT) & PTE_PERM_MASK));
+}
+
+//Map a page that has never been touched onto a frame that already exists,
+//if there is one: a cached text page, or the zero frame for a heap or stack
+//read. Returns 1 if it did, 0 if the caller has to allocate a frame.
+
+static
+int
+map_existing(page_table_entry *PTE, int permissions, vaddr_t vaddr, u_int32_t region_no, int faulttype)
+{
+  if (region_no == TEXT) {
+    return pcache_map(PTE, permissions, vaddr);
+  }
+
+  if (region_zero_filled(region_no) && faulttype == VM_FAULT_READ) {
+    zero_map(PTE, permissions);
+    return 1;
+  }
+
+  return 0;
+}
+
+/*Load a text or data page from the executable, along with a window of the
+  pages after it that aren't mapped yet, in a single VOP_READ. The window
+  starts at READAHEAD_MIN pages and doubles every time a fault lands on the
+  page just past the previous window, so a program running straight through
+  its text pulls it in with a few large reads instead of one per page. The
+  faulting page is already mapped (and pinned) by the caller; the extra pages
+  are mapped and pinned here until the read is done.
+
+  Text pages are then handed to the page cache for other processes running
+  the same program, and remapped copy-on-write here. A text window also stops
+  at the first page that is already cached; that one is just mapped.*/
+
+static
+int
+alloc_segment_on_demand(vaddr_t faultaddress, unsigned int region_no, int permissions){
+
+  assert(curspl > 0); //Interrupts should still be off
+
+  struct addrspace *as = curthread->t_vmspace;
+  struct segment *seg = &as->memory_segments[region_no];
+  struct page_table_entry_array *level_2_page_table;
+  page_table_entry *PTE;
+  vaddr_t segtop, vaddr;
+  size_t filesize, segoffset, npages, window, i;
+  off_t offset;
+  int is_executable;
+
+  segtop = seg->v_base + seg->npages * PAGE_SIZE;
+
+  if (faultaddress == as->as_ra_next[region_no]) {
+    window = as->as_ra_window[region_no] * 2;
+    if (window > READAHEAD_MAX) {
+      window = READAHEAD_MAX;
+    }
+  }
+  else {
+    window = READAHEAD_MIN;
+  }
+
+  //Grow the read over following pages until the window is full, the segment
+  //ends, or a page is already there. Running short of frames just means a
+  //smaller read.
+
+  for (npages = 1; npages < window; npages++) {
+    vaddr = faultaddress + npages * PAGE_SIZE;
+    if (vaddr >= segtop) {
+      break;
+    }
+
+    level_2_page_table = as->master_page_table[(vaddr & FIRST_LEVEL_PAGE_TABLE_INDEX_MASK) >> VPN_BITS];
+    if (level_2_page_table == NULL) {
+      level_2_page_table = page_table_L2_create();
+      if (level_2_page_table == NULL) {
+        break;
+      }
+      as->master_page_table[(vaddr & FIRST_LEVEL_PAGE_TABLE_INDEX_MASK) >> VPN_BITS] = level_2_page_table;
+    }
 
-// //Now copy the segments info.
-//
-  unsigned int i;
-//
-  for (i = 0; i < NUM_SEGMENTS; i++){
-      new->memory_segments[i].v_base = old->memory_segments[i].v_base;
-      new->memory_segments[i].npages = old->memory_segments[i].npages;
-      new->memory_segments[i].permissions = old->memory_segments[i].permissions;
+    PTE = &level_2_page_table->second_level_page_table[(vaddr & SECOND_LEVEL_PAGE_TABLE_INDEX_MASK) >> OFFSET_BITS];
+    if (*PTE & PTE_VALID) {
+      break;
+    }
+    if (region_no == TEXT && pcache_map(PTE, permissions, vaddr)) {
+      break;
+    }
+    if (create_PTE(PTE, permissions, vaddr, 0)) {
+      break;
+    }
   }
 
-  //Page table next.
+  as->as_ra_next[region_no] = faultaddress + npages * PAGE_SIZE;
+  as->as_ra_window[region_no] = window;
 
-  for(i = 0; i < NUMBER_OF_PAGE_TABLE_ENTRIES; i++){
+  //Only the part of the window that lies within the segment's file image is
+  //read; the rest (the tail of the last page, or bss) is zero-filled.
 
-    if (old->master_page_table[i] != NULL){
+  segoffset = faultaddress - seg->v_base;
+  offset = (as->as_v).offset[region_no] + segoffset;
+  filesize = (as->as_v).filesize[region_no];
+  filesize = filesize > segoffset ? filesize - segoffset : 0;
 
-      new->master_page_table[i] = kmalloc(sizeof(struct page_table_entry_array));
+  is_executable = permissions & PF_X;
 
-      int j;
-      for (j = 0; j < NUMBER_OF_PAGE_TABLE_ENTRIES; j++){
+  vmstats.vs_elf_loads++;
+  vmstats.vs_elf_readahead += npages - 1;
 
-        if (old->master_page_table[i]->second_level_page_table[j] != NULL){
+  int result = load_segment(as->as_v.as_vnode, offset, faultaddress,
+                            npages * PAGE_SIZE, filesize, is_executable);
 
-          new->master_page_table[i]->second_level_page_table[j] = kmalloc(sizeof(struct page_table_entry));
-          (new->master_page_table[i]->second_level_page_table[j])->permissions = (old->master_page_table[i]->second_level_page_table[j])->permissions;
-          (new->master_page_table[i]->second_level_page_table[j])->pfn = getppages(1); //get a fresh frame
-        }
+  for (i = 0; i < npages; i++) {
+    vaddr = faultaddress + i * PAGE_SIZE;
+    level_2_page_table = as->master_page_table[(vaddr & FIRST_LEVEL_PAGE_TABLE_INDEX_MASK) >> VPN_BITS];
+    PTE = &level_2_page_table->second_level_page_table[(vaddr & SECOND_LEVEL_PAGE_TABLE_INDEX_MASK) >> OFFSET_BITS];
 
-        else{
-          new->master_page_table[i]->second_level_page_table[j] = old->master_page_table[i]->second_level_page_table[j]; //the original points to NULL so just set this
-        }
-      }
-    }
-    else {
-      //Old master table is NULL, copy it.
-      new->master_page_table[i] = old->master_page_table[i];
-    }
-  }
+    //The fresh copy was mapped writable for loading; once it is shared
+    //through the cache, write-protect it.
 
-  for (i = 0; i < NUM_STATIC_SEGMENTS; i++) {
-    (new->as_v).filesize[i] = (old->as_v).filesize[i];
-    (new->as_v).offset[i] = (old->as_v).offset[i];
-  }
+    if (result == 0 && region_no == TEXT &&
+        pcache_insert(as->as_v.as_vnode, offset + i * PAGE_SIZE, PTE_PADDR(*PTE)) == 0) {
+      pte_set(as, PTE, (*PTE & ~PTE_DIRTY) | PTE_COW);
+      tlb_unmap(as, vaddr);
+    }
 
-  // /*Inherit the vnode.*/
-  // if (old->as_v.as_vnode != NULL) {
-  //
-  //   // VOP_INCOPEN(old->as_v.as_vnode);
-  //   VOP_INCREF(old->as_v.as_vnode);
-  //
-  //   new->as_v.as_vnode = kmalloc(sizeof(struct vnode));
-  //
-	// 	if (new->as_v.as_vnode == NULL) {
-  //     kfree(new->as_v.as_vnode);
-	// 		return ENOMEM;
-	// 	}
-  //
-	// 	memcpy(new->as_v.as_vnode, old->as_v.as_vnode, sizeof(struct vnode));
-  // }
-
-  // //Copy the vnode while making sure to increase the reference count.
-  //
-  VOP_INCOPEN((old->as_v).as_vnode);
-  VOP_INCREF((old->as_v).as_vnode);
-  //
-  // struct vnode temp = *(old->as_v).as_vnode;
-  // (new->as_v).as_vnode = &temp;
+    //The faulting page is unpinned by the caller.
 
-  *ret = new;
+    if (i > 0) {
+      page_unpin(PTE_PADDR(*PTE));
+    }
+  }
 
-  splx(spl);
-	return 0;
+  return result;
 }
 
+/*******************************LARGE PAGES************************************/
+
 int
-as_prepare_load(struct addrspace *as)
+vm_getlargepages(void)
 {
-  //Setup heap
-  (as->memory_segments[HEAP]).v_base = (as->memory_segments[DATA]).v_base + (as->memory_segments[DATA]).npages*PAGE_SIZE; //end of data = heap.
-  (as->memory_segments[HEAP]).npages = (size_t)0;
-  (as->memory_segments[HEAP]).permissions = PF_R | PF_W;
-  as->as_brk = (as->memory_segments[HEAP]).v_base; //initial break value is the base
-  as->heap_max = (as->memory_segments[HEAP]).v_base + 81290;
-
-  //Setup stack
-  (as->memory_segments[STACK]).v_base = USERSTACK;
-  (as->memory_segments[STACK]).npages = JAFFVM_STACKPAGES;
-  (as->memory_segments[STACK]).permissions = PF_R | PF_W;
-  as->as_stackptr = USERSTACK; //initially stack points at the top of user VAs
-
-  return 0;
+  return lpage_enabled;
 }
 
-int
-as_complete_load(struct addrspace *as)
+void
+vm_setlargepages(int on)
 {
-  //assert(); //assume the heap and stack don't overlap
-  (void)as;
-	return 0;
+  lpage_enabled = on;
 }
 
-int
-as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+//Take a block of LPAGE_PAGES contiguous frames for the run starting at vaddr
+//and zero them. Each frame is its own allocation from then on, so pages of a
+//run can be evicted, unmapped or copied one at a time. Only frames the
+//allocator can spare above the pageout watermark are used; this never sleeps
+//or evicts, and a fault that can't get a run maps a single page instead.
+//The frames come back pinned, like alloc_upage().
+
+static
+paddr_t
+alloc_upage_run(struct addrspace *as, vaddr_t vaddr)
 {
-	(void)as;
-	/* Initial user-level stack pointer */
-	*stackptr = USERSTACK;
-	return 0;
-}
+  int index;
+  u_int32_t i;
 
-/*****************************PAGE TABLE FUNCTIONS*****************************/
+  if (num_free_coremap_entries < pageout_high + LPAGE_PAGES) {
+    return 0;
+  }
 
-/*Intended to be bitwise ANDED with the fault address in question to retain the
-  first 10 bits.*/
-#define FIRST_LEVEL_PAGE_TABLE_INDEX_MASK 0xFFC00000
+  index = buddy_alloc(LPAGE_PAGES);
+  if (index < 0) {
+    return 0;
+  }
 
-/*Intended to be bitwise ANDED with the fault address in question to retain the
-  mid 10 bits.*/
-#define SECOND_LEVEL_PAGE_TABLE_INDEX_MASK 0x003FF000
+  num_free_coremap_entries -= LPAGE_PAGES;
+  pageout_poke();
 
-//similarly get the offset
+  for (i = 0; i < LPAGE_PAGES; i++) {
+    coremap[index + i].is_allocated = 1;
+    coremap[index + i].chunk_size = 1;
+    upage_init(coremap[index + i].page_frame, as, vaddr + i * PAGE_SIZE);
+    page_zero(coremap[index + i].page_frame);
+  }
 
-#define OFFSET_MASK 0x00000FFF
+  vmstats.vs_zero_fills += LPAGE_PAGES;
+  vmstats.vs_zero_sync += LPAGE_PAGES;
+  vmstats.vs_lpage_runs++;
 
-#define VPN_BITS 22
-#define OFFSET_BITS 12
+  return coremap[index].page_frame;
+}
 
-//helper function to initialize the 2nd level of the page table.
+//Map the whole aligned run around vaddr in one go, if it lies entirely within
+//the heap or an anonymous mapping and none of it has been touched yet.
+//Returns 1 if it did. The faulting page's frame is left pinned, as
+//create_PTE() leaves it; the rest of the run is ready for use.
 
 static
-struct page_table_entry_array*
-page_table_L2_create(){
+int
+run_map(struct page_table_entry_array *level_2_page_table, vaddr_t vaddr,
+        int permissions, u_int32_t region_no)
+{
+  struct addrspace *as = curthread->t_vmspace;
+  vaddr_t base = vaddr & ~(vaddr_t)(LPAGE_SIZE - 1);
+  vaddr_t lo, hi;
+  page_table_entry *PTE;
+  paddr_t paddr;
+  u_int32_t i;
 
-  struct page_table_entry_array *level2_pagetable = kmalloc(sizeof(struct page_table_entry_array));
-  if (level2_pagetable == NULL){
-    return NULL;
+  if (!lpage_enabled) {
+    return 0;
   }
 
-  int i;
-	for (i = 0; i < NUMBER_OF_PAGE_TABLE_ENTRIES; i++) {
-		level2_pagetable->second_level_page_table[i] = NULL ;
-	}
-  return (level2_pagetable);
-}
+  if (region_no == HEAP) {
+    lo = (as->memory_segments[HEAP]).v_base;
+    hi = as->as_brk;
+  }
+  else if (region_no == MMAP_ANON) {
+    struct vm_region *vr = as_find_region(as, vaddr);
+    lo = vr->vr_base;
+    hi = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+  }
+  else {
+    return 0;
+  }
 
-//helper fn to create a PTE
+  if (base < lo || base + LPAGE_SIZE > hi) {
+    return 0;
+  }
 
-static
-struct page_table_entry*
-create_PTE(int permissions) {
+  //A run is aligned to its own size, so it never straddles two second level
+  //tables.
 
-  assert(curspl > 0); //Interrupts should still be off
+  PTE = &level_2_page_table->second_level_page_table[(base & SECOND_LEVEL_PAGE_TABLE_INDEX_MASK) >> OFFSET_BITS];
 
-  //Allocate a page for the segment on demand
+  for (i = 0; i < LPAGE_PAGES; i++) {
+    if (PTE[i] & PTE_VALID) {
+      return 0;
+    }
+  }
 
-  struct page_table_entry * PTE = kmalloc(sizeof(struct page_table_entry));
-  if (PTE == NULL) {
-    return NULL;
+  paddr = alloc_upage_run(as, base);
+  if (paddr == 0) {
+    return 0;
   }
 
-  PTE->pfn = getppages(1); //allocate a new frame
-  PTE->permissions = permissions;
+  for (i = 0; i < LPAGE_PAGES; i++) {
+    pte_set(as, &PTE[i], (paddr + i * PAGE_SIZE) | PTE_VALID | PTE_DIRTY | PTE_RUN |
+            ((permissions << PTE_PERM_SHIFT) & PTE_PERM_MASK));
+    if (base + i * PAGE_SIZE != vaddr) {
+      page_unpin(paddr + i * PAGE_SIZE);
+    }
+  }
 
-  return PTE;
+  return 1;
 }
 
-//Function to find a PTE given a VPN (already divided into the higher and lower
-//bits). We return a pointer to the page table entry.
+//Load the other resident pages of the run around vaddr into the TLB, so that
+//a sweep through a run misses once instead of once per page. Call this before
+//loading vaddr itself, so the replacement policy can't throw out the entry
+//the faulting access needs. Neighbours keep their reference bits as they are;
+//it is up to the program to actually use them.
 
 static
-struct page_table_entry*
-find_page_table_entry (struct addrspace *as, u_int32_t idx_L1, u_int32_t idx_L2, unsigned int operation_type, int *err)
+void
+tlb_load_run(struct addrspace *as, struct page_table_entry_array *level_2_page_table, vaddr_t vaddr)
 {
-    //Strategy: use the master & secondary page numbers. This allows
-    //you to access the various levels of the cache. Then check the permissions
-    //flag. Are we allowed to perform the operation? If yes, then return the found
-    //PTE. If there is no existing such PTE, return NULL.
+  vaddr_t base = vaddr & ~(vaddr_t)(LPAGE_SIZE - 1);
+  page_table_entry *PTE;
+  u_int32_t i, ehi, elo;
 
-    struct page_table_entry* searched = NULL;
+  PTE = &level_2_page_table->second_level_page_table[(base & SECOND_LEVEL_PAGE_TABLE_INDEX_MASK) >> OFFSET_BITS];
 
-    assert(as != NULL);
-    assert(as->master_page_table[idx_L1] != NULL); //at least the 1st level must be pointing
-                                                  //to a valid substructure in L2.
+  for (i = 0; i < LPAGE_PAGES; i++) {
 
-    searched = (as->master_page_table[idx_L1])->second_level_page_table[idx_L2];
+    if (base + i * PAGE_SIZE == vaddr ||
+        (PTE[i] & (PTE_VALID | PTE_SWAPPED | PTE_RUN)) != (PTE_VALID | PTE_RUN)) {
+      continue;
+    }
 
-    // if(searched != NULL){
-    //   if (operation_type != searched->permissions){
-    //     *err = EFAULT; //an invalid operation
-    //   }
-    // }
+    ehi = as_tlbhi(as, base + i * PAGE_SIZE);
+    if (TLB_Probe(ehi, 0) >= 0) {
+      continue;
+    }
 
-    // if (searched == NULL) {
-    //   *err = EFAULT;
-    // }
-    return (searched);
+    elo = PTE_PADDR(PTE[i]) | TLBLO_VALID;
+    if (!(PTE[i] & PTE_COW) && (PTE[i] & PTE_DIRTY)) {
+      elo |= TLBLO_DIRTY;
+    }
+
+    if (tlb_replace(ehi, elo, 0)) {
+      vmstats.vs_tlb_evictions++;
+    }
+    vmstats.vs_tlb_prefills++;
+  }
 }
 
+/*******************************VM_FAULT***************************************/
+
+//helper function to determine if the fault address lies within a segment
+
 static
 int
-alloc_segment_on_demand(vaddr_t faultaddress, unsigned int region_no, int permissions){
+check_address_region(u_int32_t vbase, u_int32_t vtop, vaddr_t faultaddress)
+{
 
-  assert(curspl > 0); //Interrupts should still be off
+  assert(vtop >= vbase);
 
-  size_t filesize;
-  off_t offset;
-  off_t region_offset;
-  struct vnode *as_vnode;
-  int is_executable;
+  if(faultaddress >= vbase && faultaddress < vtop){
+    return 1;
+  }
+  else return 0;
+}
 
-  as_vnode = (curthread->t_vmspace->as_v).as_vnode;
+//Give the faulting address space a private copy of a copy-on-write page. If
+//nobody else maps the frame any more it is simply taken over.
 
-  // assert (as_vnode->vn_refcount > 0);
-  // assert(as_vnode->vn_ops != (char *)0xdeadbeef);
+static
+int
+break_cow(page_table_entry *PTE, vaddr_t vaddr)
+{
+  assert(curspl > 0); //Interrupts should still be off
+  assert(*PTE & PTE_COW);
 
+  paddr_t old_paddr = PTE_PADDR(*PTE);
+  u_int32_t index = PADDR_TO_COREMAP_INDEX(old_paddr);
 
-  region_offset = (curthread->t_vmspace->as_v).offset[region_no];
+  if (coremap[index].refcount == 1) {
+    coremap[index].as = curthread->t_vmspace;
+    coremap[index].vaddr = vaddr;
+    pte_set(curthread->t_vmspace, PTE, *PTE & ~PTE_COW);
+    return 0;
+  }
 
-  offset = region_offset + (faultaddress) - (curthread->t_vmspace->memory_segments[region_no]).v_base;
+  //Allocating may sleep while pages are evicted, and meanwhile the other
+  //sharers can exit and leave the old frame evictable. Keep it pinned until
+  //it has been copied.
 
-  filesize = (curthread->t_vmspace->as_v).filesize[region_no];
+  page_pin(old_paddr);
 
-  is_executable = permissions & PF_X;
+  //Nothing to copy out of the zero frame; just get a zeroed one.
 
-  int result = load_segment(as_vnode, offset, faultaddress, PAGE_SIZE, filesize, is_executable);
+  paddr_t new_paddr = (old_paddr == zero_paddr) ?
+                      alloc_upage_zeroed(curthread->t_vmspace, vaddr) :
+                      alloc_upage(curthread->t_vmspace, vaddr);
+  if (new_paddr == 0) {
+    page_unpin(old_paddr);
+    return ENOMEM;
+  }
 
-  return result;
+  if (old_paddr != zero_paddr) {
+    memcpy((void *)PADDR_TO_KVADDR(new_paddr), (void *)PADDR_TO_KVADDR(old_paddr), PAGE_SIZE);
+    vmstats.vs_cow_copies++;
+  }
 
-}
+  //The read-only translation of the old frame goes before our reference to it
+  //does. The fault handler loads the new one.
 
-/*******************************VM_FAULT***************************************/
+  tlb_unmap(curthread->t_vmspace, vaddr);
 
-//helper function to determine if the fault address lies within a segment
+  page_unpin(old_paddr);
+  free_upage(old_paddr, curthread->t_vmspace); //drop our reference to the shared frame
 
-static
-int
-check_address_region(u_int32_t vbase, u_int32_t vtop, vaddr_t faultaddress)
-{
+  //The copy has nothing on disk, so it starts out dirty.
 
-  assert(vtop >= vbase);
+  pte_set(curthread->t_vmspace, PTE, new_paddr | (*PTE & ~(PTE_FRAME | PTE_COW)) | PTE_DIRTY);
 
-  if(faultaddress >= vbase && faultaddress < vtop){
-    return 1;
-  }
-  else return 0;
+  page_unpin(new_paddr);
+
+  return 0;
 }
 
 static
@@ -690,9 +2382,8 @@ TLB_page_fault_handler(int faulttype, vaddr_t faultaddress, int permissions, u_i
 
   switch (faulttype) {
       case VM_FAULT_READONLY:
-          /* We always create pages read-write, so we can't get this */
-          panic("Invalid: fault on page read");
-
+          /* A write hit a page we mapped without write permission. That
+             only happens for copy-on-write pages, checked below. */
       case VM_FAULT_READ:
       case VM_FAULT_WRITE:
           break;
@@ -718,9 +2409,19 @@ TLB_page_fault_handler(int faulttype, vaddr_t faultaddress, int permissions, u_i
       return (ENOMEM);
     }
 
-    level_2_page_table->second_level_page_table[level_2_index] = create_PTE(permissions);
-    if (level_2_page_table->second_level_page_table[level_2_index] == NULL){
-      return (ENOMEM);
+    if (run_map(level_2_page_table, faultaddress, permissions, region_no)) {
+      //The whole run is mapped; the faulting page needs no loading.
+    }
+    else if (map_existing(&level_2_page_table->second_level_page_table[level_2_index], permissions, faultaddress, region_no, faulttype)) {
+      loaded = 1;
+    }
+    else {
+      err = create_PTE(&level_2_page_table->second_level_page_table[level_2_index], permissions, faultaddress,
+                       region_zero_filled(region_no));
+      if (err){
+        free_kpages((vaddr_t)level_2_page_table);
+        return (err);
+      }
     }
 
     curthread->t_vmspace->master_page_table[level_1_index] = level_2_page_table;
@@ -732,12 +2433,21 @@ TLB_page_fault_handler(int faulttype, vaddr_t faultaddress, int permissions, u_i
 
     level_2_page_table = curthread->t_vmspace->master_page_table[level_1_index];
 
-    struct page_table_entry *existing_page = find_page_table_entry(curthread->t_vmspace, level_1_index, level_2_index, faulttype, &err);
+    page_table_entry *existing_page = find_page_table_entry(curthread->t_vmspace, level_1_index, level_2_index, faulttype, &err);
 
     if (existing_page == NULL){
-        level_2_page_table->second_level_page_table[level_2_index] = create_PTE(permissions);
-        if (level_2_page_table->second_level_page_table[level_2_index] == NULL){
-          return (ENOMEM);
+        if (run_map(level_2_page_table, faultaddress, permissions, region_no)) {
+          //As above.
+        }
+        else if (map_existing(&level_2_page_table->second_level_page_table[level_2_index], permissions, faultaddress, region_no, faulttype)) {
+          loaded = 1;
+        }
+        else {
+          err = create_PTE(&level_2_page_table->second_level_page_table[level_2_index], permissions, faultaddress,
+                           region_zero_filled(region_no));
+          if (err){
+            return (err);
+          }
         }
     }
 
@@ -746,6 +2456,41 @@ TLB_page_fault_handler(int faulttype, vaddr_t faultaddress, int permissions, u_i
     }
   }
 
+  page_table_entry *PTE = &level_2_page_table->second_level_page_table[level_2_index];
+
+/******************************PAGE-IN******************************************/
+
+  if (*PTE & PTE_SWAPPED) {
+    err = page_in(curthread->t_vmspace, PTE, faultaddress);
+    if (err) {
+      return err;
+    }
+  }
+
+/******************************COPY-ON-WRITE************************************/
+
+  if (faulttype == VM_FAULT_READONLY && !(*PTE & PTE_COW) && (*PTE & PTE_DIRTY)) {
+    //A write to a page that is neither shared nor clean - nothing we can fix.
+    return EFAULT;
+  }
+
+  //Break sharing on the first write, whether it arrives as a write to a
+  //read-only TLB entry or as a write miss on a page not yet in the TLB.
+
+  if (faulttype != VM_FAULT_READ && (*PTE & PTE_COW)) {
+    err = break_cow(PTE, faultaddress);
+    if (err) {
+      return err;
+    }
+  }
+
+  //Clean pages are mapped read-only too, so the first write after a page-in
+  //or a pageout lands here. The copy in swap is stale from now on.
+
+  if (faulttype != VM_FAULT_READ) {
+    *PTE |= PTE_DIRTY;
+  }
+
   //If the page entry ^ was valid (non-NULL), it was just a TLB miss. Either ways
   //we need to update the TLB.
 
@@ -755,39 +2500,45 @@ TLB_page_fault_handler(int faulttype, vaddr_t faultaddress, int permissions, u_i
 
   assert(curspl > 0); //Interrupts should still be off
 
-  paddr_t paddr = ((level_2_page_table->second_level_page_table[level_2_index]->pfn)) | offset;
+  paddr_t paddr = PTE_PADDR(*PTE) | offset;
 
   // Must be page aligned.
   assert((paddr & PAGE_FRAME) == paddr);
 
-  //Update the TLB. First traverse through, until we find an empty entry
-  //Then write the latest mapping onto there.
+  //Shared and clean pages are mapped without the dirty (write-enable) bit so
+  //that the first write traps back to us.
 
   u_int32_t ehi, elo;
-  unsigned int written = 0;
   int i;
 
-      for (i=0; i<NUM_TLB; i++) {
-    		TLB_Read(&ehi, &elo, i);
-    		if (elo & TLBLO_VALID) {
-    			continue;
-    		}
-    		ehi = faultaddress;
-    		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-    		DEBUG(DB_VM, "TLB_entry: 0x%x -> 0x%x\n", faultaddress, paddr);
-        assert((TLB_Probe(ehi, 0) < 0) || !(elo & TLBLO_VALID));   //check no duplicate entries
-    		TLB_Write(ehi, elo, i);
-    		written = 1;
-        break;
-    	}
+  ehi = as_tlbhi(curthread->t_vmspace, faultaddress);
+  elo = paddr | TLBLO_VALID;
+  if (!(*PTE & PTE_COW) && (*PTE & PTE_DIRTY)) {
+    elo |= TLBLO_DIRTY;
+  }
+
+  //The page is in use again as far as the replacement clock is concerned.
+
+  *PTE |= PTE_REFERENCED;
 
-      if (!written){
-        ehi = faultaddress;
-        elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+  //If the page is already in the TLB (a copy-on-write break), replace that
+  //entry in place. Otherwise let the replacement policy pick a slot; see
+  //arch/mips/mips/tlb.c.
 
-        //TLB is full. Evict an entry and replace it with the new one
-        TLB_Random(ehi, elo);
-     }
+  if (*PTE & PTE_RUN) {
+    tlb_load_run(curthread->t_vmspace, level_2_page_table, faultaddress);
+  }
+
+  i = TLB_Probe(ehi, 0);
+  if (i >= 0) {
+    TLB_Write(ehi, elo, i);
+  }
+  else {
+    DEBUG(DB_VM, "TLB_entry: 0x%x -> 0x%x\n", faultaddress, paddr);
+    if (tlb_replace(ehi, elo, region_no == TEXT || region_no == STACK)) {
+      vmstats.vs_tlb_evictions++;
+    }
+  }
       //ensure we have updated the TLB successfully. That is, the next time we
       //search for this vaddr, it should be a TLB hit. This means there should be
       //a matching entry in the TLB with the valid bit set.
@@ -800,15 +2551,16 @@ TLB_page_fault_handler(int faulttype, vaddr_t faultaddress, int permissions, u_i
       if (((region_no == TEXT) && (!loaded)) || ((region_no == DATA) && (!loaded))) {
         err = alloc_segment_on_demand(faultaddress, region_no, permissions);
       }
+      else if (region_no == MMAP_FILE && !loaded) {
+        err = region_fill(as_find_region(curthread->t_vmspace, faultaddress), faultaddress, paddr);
+      }
+
+      //A fresh frame stays pinned until it has been filled; see create_PTE().
+
+      if (!loaded) {
+        page_unpin(paddr);
+      }
 
-      /*if (region_no == STACK){
-        if (!(faultaddress > HEAP_MAX && faultaddress < curthread->t_vmspace->as_stackptr)){
-            return EFAULT;
-        }
-        else{
-          curthread->t_vmspace->as_stackptr = faultaddress; //faultaddress is page aligned, so the stackptr is too
-        }
-      }*/
       return (err);
 }
 
@@ -827,6 +2579,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
   DEBUG(DB_VM, "vm_fault(): 0x%x\n", faultaddress);
 
+  vmstats.vs_faults++;
+  if (faulttype == VM_FAULT_READONLY) {
+    vmstats.vs_tlb_readonly++;
+  }
+
   as = curthread->t_vmspace;
 	if (as == NULL) {
 		/*
@@ -834,6 +2591,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		 * fault early in boot. Return EFAULT so as to panic
 		 * instead of getting into an infinite faulting loop.
 		 */
+		splx(spl);
 		return EFAULT;
 	}
 
@@ -878,14 +2636,28 @@ vm_fault(int faulttype, vaddr_t faultaddress)
       permissions = PF_R | PF_W; //the stack is read-write
       err = TLB_page_fault_handler(faulttype, faultaddress, permissions, HEAP);
       splx(spl);
-      return 0;
+      return err;
     }
   }
-  //now check if it's in the stack.
+  //then in a region mapped with mmap().
+
+  if (!found_addr){
+    struct vm_region *vr = as_find_region(as, faultaddress);
+    if (vr != NULL){
+      found_addr = 1;
+      err = TLB_page_fault_handler(faulttype, faultaddress, vr->vr_permissions,
+                                   vr->vr_vnode != NULL ? MMAP_FILE : MMAP_ANON);
+      splx(spl);
+      return err;
+    }
+  }
+
+  //now check if it's in the stack, growing it if the fault is just below.
 
   if (!found_addr){
     int result;
-    result = check_address_region((USERSTACK - JAFFVM_STACKPAGES*PAGE_SIZE), USERSTACK, faultaddress);
+    result = check_address_region(as->as_stackptr, USERSTACK, faultaddress) ||
+             (faultaddress < as->as_stackptr && as_grow_stack(as, faultaddress) == 0);
     if (result){
       found_addr = 1;
       permissions = PF_R | PF_W; //the stack is read-write
@@ -899,8 +2671,82 @@ vm_fault(int faulttype, vaddr_t faultaddress)
                     //address in one of the segments, it is a segmentation fault;
 }
 
+/*Fast path for TLB misses, tried by mips_trap() before vm_fault(). Most misses
+  are on pages that are already resident and just fell out of the TLB, so go
+  straight to the PTE and load it with tlb_replace(), skipping the segment
+  search. Anything unusual (no valid PTE, swapped out, a write to a COW page)
+  returns EFAULT and is left to vm_fault(). Since a miss means no entry for
+  this page and ASID is in the TLB, loading it can't create a duplicate.*/
+
+int
+vm_tlbrefill(int faulttype, vaddr_t faultaddress)
+{
+  struct addrspace *as = curthread->t_vmspace;
+  struct page_table_entry_array *level_2_page_table;
+  page_table_entry *PTE;
+  u_int32_t elo;
+
+  int spl = splhigh();
+
+  vmstats.vs_tlb_misses++;
+
+  if (as == NULL || faultaddress >= USERTOP) {
+    goto slow;
+  }
+
+  level_2_page_table = as->master_page_table[(faultaddress & FIRST_LEVEL_PAGE_TABLE_INDEX_MASK) >> VPN_BITS];
+  if (level_2_page_table == NULL) {
+    goto slow;
+  }
+
+  PTE = &level_2_page_table->second_level_page_table[(faultaddress & SECOND_LEVEL_PAGE_TABLE_INDEX_MASK) >> OFFSET_BITS];
+
+  if ((*PTE & (PTE_VALID | PTE_SWAPPED)) != PTE_VALID) {
+    goto slow;
+  }
+
+  if (faulttype == VM_FAULT_WRITE) {
+    if (*PTE & PTE_COW) {
+      goto slow;
+    }
+    *PTE |= PTE_DIRTY;
+  }
+
+  elo = PTE_PADDR(*PTE) | TLBLO_VALID;
+  if (!(*PTE & PTE_COW) && (*PTE & PTE_DIRTY)) {
+    elo |= TLBLO_DIRTY;
+  }
+
+  *PTE |= PTE_REFERENCED;
+
+  if (*PTE & PTE_RUN) {
+    tlb_load_run(as, level_2_page_table, faultaddress);
+  }
+
+  if (tlb_replace(as_tlbhi(as, faultaddress), elo, as_tlbpin(as, faultaddress))) {
+    vmstats.vs_tlb_evictions++;
+  }
+
+  vmstats.vs_tlb_fast++;
+  splx(spl);
+  return 0;
+
+ slow:
+  vmstats.vs_tlb_slow++;
+  splx(spl);
+  return EFAULT;
+}
+
 void
 vm_bootstrap(void)
 {
-	/* Do nothing. */
+	/* The console and disks are attached by now. */
+	swap_bootstrap();
+
+	zero_paddr = getppages(1);
+	if (zero_paddr == 0) {
+		panic("vm: no memory for the zero frame\n");
+	}
+	page_zero(zero_paddr);
+	coremap[PADDR_TO_COREMAP_INDEX(zero_paddr)].refcount = 1;
 }
@@ -0,0 +1,207 @@
+/*
+ * Shared page cache for program text.
+ *
+ * A small hash table of (vnode, offset) -> frame. Entries are added by
+ * the fault handler after it has loaded a text page from an executable
+ * and looked up before it loads another, so a binary that several
+ * processes run is read from disk once.
+ *
+ * A cached frame always has a coremap refcount of at least one (the
+ * cache's own). When that is the only reference left, nobody maps the
+ * page and pcache_reclaim() may drop it; the pageout daemon does so
+ * before it starts paging anything out. Nothing here notices if an
+ * executable is rewritten while its pages are cached.
+ *
+ * pcache_reclaim() also runs on the allocation path, where dropping
+ * the last reference to a vnode (and so reclaiming it, maybe writing
+ * its inode back) is not safe. Freed entries keep their vnode
+ * reference on pcache_dead until the pageout daemon calls
+ * pcache_release() from thread context.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <vnode.h>
+#include <vm.h>
+#include <pagecache.h>
+
+struct pcache_entry {
+	struct vnode *pe_vnode;
+	off_t pe_offset;
+	paddr_t pe_paddr;
+	struct pcache_entry *pe_next;
+};
+
+static struct pcache_entry *pcache_table[PCACHE_BUCKETS];
+
+/* Reclaimed entries whose vnode reference is still to be dropped. */
+static struct pcache_entry *pcache_dead;
+
+static
+unsigned
+pcache_hash(struct vnode *v, off_t offset)
+{
+	return (((u_int32_t)v >> 4) ^ (u_int32_t)(offset / PAGE_SIZE))
+		% PCACHE_BUCKETS;
+}
+
+static
+struct pcache_entry *
+pcache_find(struct vnode *v, off_t offset)
+{
+	struct pcache_entry *pe;
+
+	for (pe = pcache_table[pcache_hash(v, offset)]; pe != NULL;
+	     pe = pe->pe_next) {
+		if (pe->pe_vnode == v && pe->pe_offset == offset) {
+			return pe;
+		}
+	}
+	return NULL;
+}
+
+paddr_t
+pcache_lookup(struct vnode *v, off_t offset)
+{
+	struct pcache_entry *pe;
+	paddr_t paddr = 0;
+	int spl;
+
+	spl = splhigh();
+
+	pe = pcache_find(v, offset);
+	if (pe != NULL) {
+		paddr = pe->pe_paddr;
+		coremap[PADDR_TO_COREMAP_INDEX(paddr)].refcount++;
+		vmstats.vs_pcache_hits++;
+	}
+
+	splx(spl);
+	return paddr;
+}
+
+int
+pcache_insert(struct vnode *v, off_t offset, paddr_t paddr)
+{
+	struct pcache_entry *pe;
+	unsigned bucket;
+	int spl;
+
+	/* Allocate first; kmalloc may end up in pcache_reclaim(). */
+	pe = kmalloc(sizeof(struct pcache_entry));
+	if (pe == NULL) {
+		return ENOMEM;
+	}
+
+	spl = splhigh();
+
+	if (pcache_find(v, offset) != NULL) {
+		splx(spl);
+		kfree(pe);
+		return EEXIST;
+	}
+
+	assert(coremap[PADDR_TO_COREMAP_INDEX(paddr)].swap_slot < 0);
+
+	pe->pe_vnode = v;
+	pe->pe_offset = offset;
+	pe->pe_paddr = paddr;
+
+	bucket = pcache_hash(v, offset);
+	pe->pe_next = pcache_table[bucket];
+	pcache_table[bucket] = pe;
+
+	coremap[PADDR_TO_COREMAP_INDEX(paddr)].refcount++;
+	VOP_INCREF(v);
+
+	splx(spl);
+	return 0;
+}
+
+/*
+ * Unlink the first entry in BUCKET that no address space maps, or return
+ * NULL if there is none.
+ */
+static
+struct pcache_entry *
+pcache_unlink_unused(unsigned bucket)
+{
+	struct pcache_entry **pp, *pe;
+	u_int32_t index;
+
+	for (pp = &pcache_table[bucket]; *pp != NULL; pp = &(*pp)->pe_next) {
+		pe = *pp;
+		index = PADDR_TO_COREMAP_INDEX(pe->pe_paddr);
+		if (coremap[index].refcount == 1 && coremap[index].pinned == 0) {
+			*pp = pe->pe_next;
+			return pe;
+		}
+	}
+	return NULL;
+}
+
+u_int32_t
+pcache_reclaim(u_int32_t target)
+{
+	struct pcache_entry *pe;
+	u_int32_t freed = 0;
+	unsigned bucket;
+	int spl;
+
+	spl = splhigh();
+
+	for (bucket = 0; bucket < PCACHE_BUCKETS &&
+		     num_free_coremap_entries < target; ) {
+
+		pe = pcache_unlink_unused(bucket);
+		if (pe == NULL) {
+			bucket++;
+			continue;
+		}
+
+		coremap[PADDR_TO_COREMAP_INDEX(pe->pe_paddr)].refcount = 0;
+		free_kpages(PADDR_TO_KVADDR(pe->pe_paddr));
+		freed++;
+
+		pe->pe_next = pcache_dead;
+		pcache_dead = pe;
+	}
+
+	if (pcache_dead != NULL && booted) {
+		/* Get the pageout daemon to drop the references. */
+		thread_wakeup(&pageout_low);
+	}
+
+	splx(spl);
+	return freed;
+}
+
+int
+pcache_release_pending(void)
+{
+	return pcache_dead != NULL;
+}
+
+void
+pcache_release(void)
+{
+	struct pcache_entry *pe;
+	int spl;
+
+	assert(in_interrupt == 0);
+
+	spl = splhigh();
+
+	while ((pe = pcache_dead) != NULL) {
+		pcache_dead = pe->pe_next;
+
+		/* This can sleep if it was the last reference. */
+		spl0();
+		VOP_DECREF(pe->pe_vnode);
+		kfree(pe);
+		splhigh();
+	}
+
+	splx(spl);
+}
@@ -0,0 +1,143 @@
+/*
+ * Swap space on a raw disk device.
+ *
+ * The device is opened once at boot and used as an array of page-sized
+ * slots. A bitmap tracks which slots are in use; the slot a page was
+ * written to is kept in its page table entry until it is paged back in
+ * or the address space goes away.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <machine/spl.h>
+#include <vm.h>
+#include <swap.h>
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;
+static u_int32_t swap_nslots;
+
+/* Serializes I/O on the swap device. */
+static struct lock *swap_lock;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	/* vfs_open may scribble on the path. */
+	strcpy(path, SWAP_DEVICE);
+
+	result = vfs_open(path, O_RDWR, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s, paging disabled\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat %s: %s\n", SWAP_DEVICE, strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is empty, paging disabled\n", SWAP_DEVICE);
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	swap_lock = lock_create("swap");
+	if (swap_map == NULL || swap_lock == NULL) {
+		panic("swap: out of memory\n");
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+int
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(u_int32_t *slot)
+{
+	int spl, result;
+
+	assert(swap_enabled());
+
+	spl = splhigh();
+	result = bitmap_alloc(swap_map, slot);
+	splx(spl);
+
+	return result ? ENOSPC : 0;
+}
+
+void
+swap_free(u_int32_t slot)
+{
+	int spl;
+
+	assert(slot < swap_nslots);
+
+	spl = splhigh();
+	assert(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	splx(spl);
+}
+
+static
+int
+swap_io(paddr_t paddr, u_int32_t slot, enum uio_rw rw)
+{
+	struct uio ku;
+	int result;
+
+	assert(slot < swap_nslots);
+	assert(bitmap_isset(swap_map, slot));
+
+	lock_acquire(swap_lock);
+
+	mk_kuio(&ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		(off_t)slot * PAGE_SIZE, rw);
+
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+
+	lock_release(swap_lock);
+
+	if (result == 0 && ku.uio_resid != 0) {
+		result = EIO;
+	}
+	return result;
+}
+
+int
+swap_out(paddr_t paddr, u_int32_t slot)
+{
+	return swap_io(paddr, slot, UIO_WRITE);
+}
+
+int
+swap_in(paddr_t paddr, u_int32_t slot)
+{
+	return swap_io(paddr, slot, UIO_READ);
+}
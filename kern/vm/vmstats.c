@@ -0,0 +1,66 @@
+/*
+ * VM statistics.
+ *
+ * The fault and paging code bumps these counters as it goes; the "vs"
+ * menu command prints them. OS/161 runs on a single CPU, so there is
+ * one block for the whole machine.
+ */
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <vm.h>
+
+struct vmstats vmstats;
+
+/* Integer percentage of PART in WHOLE, 0 if WHOLE is 0. */
+static
+u_int32_t
+percent(u_int32_t part, u_int32_t whole)
+{
+	return whole ? (part * 100) / whole : 0;
+}
+
+void
+vmstats_print(void)
+{
+	struct vmstats vs;
+	int spl;
+
+	/* Take a consistent snapshot. */
+	spl = splhigh();
+	vs = vmstats;
+	splx(spl);
+
+	kprintf("VM statistics:\n");
+	kprintf("  TLB misses:        %10u\n", vs.vs_tlb_misses);
+	kprintf("    fast refills:    %10u (%u%%)\n", vs.vs_tlb_fast,
+		percent(vs.vs_tlb_fast, vs.vs_tlb_misses));
+	kprintf("    via vm_fault:    %10u\n", vs.vs_tlb_slow);
+	kprintf("  TLB modify faults: %10u\n", vs.vs_tlb_readonly);
+	kprintf("  TLB evictions:     %10u\n", vs.vs_tlb_evictions);
+	kprintf("  TLB prefills:      %10u\n", vs.vs_tlb_prefills);
+	kprintf("  Page faults:       %10u\n", vs.vs_faults);
+	kprintf("    zero-fill:       %10u\n", vs.vs_zero_fills);
+	kprintf("      from pool:     %10u (%u%%)\n", vs.vs_zero_pool,
+		percent(vs.vs_zero_pool, vs.vs_zero_fills));
+	kprintf("      zeroed inline: %10u\n", vs.vs_zero_sync);
+	kprintf("    zero-page maps:  %10u\n", vs.vs_zero_maps);
+	kprintf("    large pages:     %10u\n", vs.vs_lpage_runs);
+	kprintf("    ELF loads:       %10u\n", vs.vs_elf_loads);
+	kprintf("      read-ahead:    %10u pages\n", vs.vs_elf_readahead);
+	kprintf("    mmap file reads: %10u\n", vs.vs_mmap_reads);
+	kprintf("    shared text:     %10u\n", vs.vs_pcache_hits);
+	kprintf("    COW copies:      %10u\n", vs.vs_cow_copies);
+	kprintf("    swap page-ins:   %10u\n", vs.vs_swap_ins);
+	kprintf("  Swap page-outs:    %10u\n", vs.vs_swap_outs);
+}
+
+void
+vmstats_reset(void)
+{
+	int spl;
+
+	spl = splhigh();
+	bzero(&vmstats, sizeof(vmstats));
+	splx(spl);
+}